@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "control.h"
+#include "snapshot.h"
+#include "common.h"
+
+static void push_control(struct __control *ctl, const struct __ctl_msg *msg)
+{
+    struct __ctl_queue *q = &ctl->queue;
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    while (tail - atomic_load_explicit(&q->head, memory_order_acquire) >= CTL_QUEUE_SIZE) {
+        /* full: wait for the epoch loop */
+        sched_yield();
+    }
+    q->msgs[tail & (CTL_QUEUE_SIZE - 1)] = *msg;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+/* Called by the epoch loop. It returns 0 if the queue is empty. */
+int pop_control(struct __control *ctl, struct __ctl_msg *msg)
+{
+    struct __ctl_queue *q = &ctl->queue;
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    if (head == atomic_load_explicit(&q->tail, memory_order_acquire)) {
+        return 0;
+    }
+    *msg = q->msgs[head & (CTL_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 1;
+}
+
+static void handle_create(struct __control *ctl, struct op_data *opd, char *sock_buf, const int n)
+{
+    int target;
+    struct __monitor *mon;
+    bool is_process = (opd->opcode == MES_PROCESS_CREATE) ? true : false;
+    bool phys = phys_regions_mon();
+    uint64_t period = (opd->num_of_region >= 2 || phys) ? ctl->pebs_sample_period : 0 ; // is hybrid
+
+    // register to monitor
+    target = enable_mon(opd->tgid, opd->tid, is_process, period, ctl->tnum, ctl->mons);
+    if (target == -1) {
+        exit_with_message("Failed to enable monitor\n");
+    } else if (target < 0) {
+        // tid not found. might be already terminated.
+        return;
+    }
+    mon = &ctl->mons[target];
+    if (opd->num_of_region >= 2 && !phys && period) { // Ignored if num_of_region is 1 or less, or with -P or -N
+        // pebs sampling
+        if ((n - sizeof(struct op_data)) != (sizeof(struct __region_info) * opd->num_of_region)) {
+            exit_with_message("Received data is invalid.\n");
+        }
+        struct __region_info *ri = (struct __region_info *)(sock_buf + sizeof(struct op_data));
+        if (set_region_info_mon(mon, opd->num_of_region, ri) < 0) {
+            exit_with_message("Received data is invalid.\n");
+        }
+    }
+    // Stop the thread while its baseline is read.
+    stop_mon(mon);
+    read_mon_baseline(mon, ctl->pmu, &ctl->snap, mon->before);
+    run_mon(mon);
+    clock_gettime(CLOCK_MONOTONIC, &mon->start_exec_ts);
+    /* the epoch loop is not to touch the monitor before activate_mon() */
+    mon->status = MONITOR_PENDING;
+
+    struct __ctl_msg msg = {
+        .opcode = MES_THREAD_CREATE,
+        .target = target,
+        .tgid = opd->tgid,
+        .tid = opd->tid,
+    };
+    push_control(ctl, &msg);
+}
+
+static void drain_socket(struct __control *ctl, char *sock_buf, const size_t sock_buf_size, const size_t sock_data_size)
+{
+    int n;
+
+    do {
+        memset(sock_buf, 0, sock_buf_size);
+        // without blocking
+        n = recv(ctl->sock, sock_buf, sock_buf_size, MSG_DONTWAIT);
+        if (n < 1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // no data
+                break;
+            } else {
+                handle_error("Failed to recv");
+            }
+        } else if (n >= sizeof(struct op_data) && n <= sock_data_size) {
+            struct op_data *opd = (struct op_data *)sock_buf;
+            DEBUG_PRINT("received data: size=%d, tgid=%u, tid=%u, opcode=%u, num_of_region=%u\n",
+                        n, opd->tgid, opd->tid, opd->opcode, opd->num_of_region);
+
+            if (opd->opcode == MES_THREAD_CREATE || opd->opcode == MES_PROCESS_CREATE) {
+                handle_create(ctl, opd, sock_buf, n);
+            } else if (opd->opcode == MES_THREAD_EXIT) {
+                // unregister from monitor in the epoch loop, and display results.
+                struct __ctl_msg msg = {
+                    .opcode = MES_THREAD_EXIT,
+                    .target = -1,
+                    .tgid = opd->tgid,
+                    .tid = opd->tid,
+                };
+                push_control(ctl, &msg);
+            }
+        } else {
+            exit_with_message("received data is invalid size: size=%d\n", n);
+        }
+    } while (n > 0); // check the next message.
+}
+
+static void *control_main(void *arg)
+{
+    struct __control *ctl = (struct __control *)arg;
+    struct epoll_event ev;
+    size_t regs_size = sizeof(struct __region_info) * ctl->nmem;
+    size_t sock_data_size = sizeof(struct op_data) + regs_size;
+    size_t sock_buf_size = sock_data_size + 1/*for size check*/;
+    char *sock_buf = (char *)malloc(sock_buf_size);
+
+    if (sock_buf == NULL) {
+        handle_error("malloc");
+    }
+    while (1) {
+        int r = epoll_wait(ctl->epfd, &ev, 1, -1);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            handle_error("Failed to epoll_wait");
+        }
+        if (r == 0) {
+            continue;
+        }
+        if (ev.data.fd == ctl->evfd) {
+            break;
+        }
+        drain_socket(ctl, sock_buf, sock_buf_size, sock_data_size);
+    }
+
+    free(sock_buf);
+    return NULL;
+}
+
+int init_control(struct __control *ctl, const int sock, const uint32_t tnum, struct __monitor *mons,
+                 struct __pmu_info *pmu, const int nmem, const uint64_t pebs_sample_period)
+{
+    struct epoll_event ev;
+
+    ctl->sock = sock;
+    ctl->tnum = tnum;
+    ctl->mons = mons;
+    ctl->pmu = pmu;
+    ctl->nmem = nmem;
+    ctl->pebs_sample_period = pebs_sample_period;
+    atomic_init(&ctl->queue.head, 0);
+    atomic_init(&ctl->queue.tail, 0);
+    init_snapshot(&ctl->snap);
+
+    ctl->evfd = eventfd(0, EFD_CLOEXEC);
+    if (ctl->evfd < 0) {
+        perror("eventfd");
+        return -1;
+    }
+    ctl->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (ctl->epfd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = sock;
+    if (epoll_ctl(ctl->epfd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = ctl->evfd;
+    if (epoll_ctl(ctl->epfd, EPOLL_CTL_ADD, ctl->evfd, &ev) < 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    if (pthread_create(&ctl->thread, NULL, control_main, ctl) != 0) {
+        fprintf(stderr, "%s pthread_create failed.\n", __func__);
+        return -1;
+    }
+    return 0;
+}
+
+void fini_control(struct __control *ctl)
+{
+    uint64_t one = 1;
+
+    if (write(ctl->evfd, &one, sizeof(one)) != sizeof(one)) {
+        perror("write");
+    }
+    pthread_join(ctl->thread, NULL);
+    close(ctl->epfd);
+    close(ctl->evfd);
+    fini_snapshot(&ctl->snap);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#ifndef __CONTROL_H
+#define __CONTROL_H
+#include <pthread.h>
+#include <stdatomic.h>
+#include "types.h"
+#include "monitor.h"
+
+/*
+ * The format for receiving an tgid,tid,opcode via a socket is as follows.
+ *   |  tgid:32bit  |  tid:32bit  |  opcode:32bit  |  num_of_region:32bit  |
+ * To emulate the hybrid memory, specify 2 or more for num_of_region.
+ * When specifying 1 or more in num_of_region, add the following format to
+ * as repeatedly as the num_of_region in addition to the above.
+ *   |  address:64bit  |  size:64bit  |
+ */
+enum opcode {
+    MES_PROCESS_CREATE = 0,
+    MES_THREAD_CREATE = 1,
+    MES_THREAD_EXIT = 2,
+};
+
+struct op_data {
+    uint32_t tgid;
+    uint32_t tid;
+    uint32_t opcode;
+    uint32_t num_of_region;
+};
+
+/* A request from the control thread to the epoch loop */
+struct __ctl_msg {
+    uint32_t opcode;    /* MES_THREAD_CREATE or MES_THREAD_EXIT */
+    int target;
+    pid_t tgid;
+    pid_t tid;
+};
+
+#define CTL_QUEUE_SIZE 4096 /* must be a power of 2 */
+
+/* Lock-free single-producer single-consumer queue */
+struct __ctl_queue {
+    _Atomic uint32_t head;  /* written by the consumer */
+    _Atomic uint32_t tail;  /* written by the producer */
+    struct __ctl_msg msgs[CTL_QUEUE_SIZE];
+};
+
+/*
+ * The control thread receives the registrations from the socket as soon as
+ * they arrive. A new thread is pinned and stopped while its baseline is read,
+ * and then it is handed to the epoch loop through the queue.
+ */
+struct __control {
+    pthread_t thread;
+    int sock;
+    int epfd;
+    int evfd;       /* to stop the thread */
+    uint32_t tnum;
+    int nmem;
+    uint64_t pebs_sample_period;
+    struct __monitor *mons;
+    struct __pmu_info *pmu;
+    struct __snapshot snap;
+    struct __ctl_queue queue;
+};
+
+int init_control(struct __control *, const int, const uint32_t, struct __monitor *, struct __pmu_info *,
+                 const int, const uint64_t);
+void fini_control(struct __control *);
+int pop_control(struct __control *, struct __ctl_msg *);
+#endif
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+// #define ONLY_CALCULATION	// not inserting the calculated delay to processes
+
+#include "common.h"
+#include "emul.h"
+#include "snapshot.h"
+#include "pebs.h"
+#include "model.h"
+#include "trace.h"
+
+/* The time from start to end in nsec, 0 if end is not after start. */
+static uint64_t elapsed_nsec(const struct timespec *start, const struct timespec *end)
+{
+    int64_t d = (int64_t)(end->tv_sec - start->tv_sec) * 1000000000 + (end->tv_nsec - start->tv_nsec);
+
+    return d > 0 ? (uint64_t)d : 0;
+}
+
+/*
+ * Stop the i-th monitor if it is running. It is called for all the monitors
+ * before the counters of the epoch are read at once.
+ */
+void emul_mon_stop(const struct __emul *emul, const int i)
+{
+    struct __monitor *mon = &emul->mons[i];
+
+    mon->epoch_stopped = false;
+    if (mon->status != MONITOR_ON) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &mon->epoch_start_ts);
+    DEBUG_PRINT("[%d:%u:%u] start_ts: %010lu.%09lu\n", i, mon->tgid, mon->tid, mon->epoch_start_ts.tv_sec, mon->epoch_start_ts.tv_nsec);
+
+#ifndef ONLY_CALCULATION
+    /*stop target process group: send SIGSTOP */
+    stop_mon(mon);
+    if (mon->status != MONITOR_OFF) {
+        return;
+    }
+#endif
+    mon->epoch_stopped = true;
+}
+
+/*
+ * Process one epoch of the i-th monitor with the snapshot of the epoch,
+ * after emul_mon_stop() is called for all the monitors. diff_nsec carries
+ * the processing time which is not yet subtracted from an injected delay.
+ * It must not be shared between threads calling this function concurrently.
+ */
+void emul_mon_epoch(const struct __emul *emul, const int i, const struct __epoch *ep, uint64_t *diff_nsec)
+{
+    struct __elem *swap;
+    struct __monitor *mon = &emul->mons[i];
+    const struct __snapshot *snap = emul->snap;
+    const struct timespec waittime = emul->waittime;
+    struct timespec start_ts, end_ts;
+
+    if (mon->status == MONITOR_DISABLE || mon->status == MONITOR_PENDING) {
+        return;
+    }
+    if (mon->resume_scheduled) {
+        /* the resume scheduler sends SIGCONT at the deadline */
+        return;
+    }
+    if (mon->epoch_stopped) {
+        mon->epoch_stopped = false;
+        start_ts = mon->epoch_start_ts;
+
+        /* CBo and CPU values of the epoch */
+        read_mon_elem(mon, snap, mon->after);
+        if (mon->model->collect != NULL) {
+            mon->model->collect(i, mon);
+        }
+        struct __model_input in;
+        read_model_input(mon, ep, &in);
+        if (trace_enabled() && trace_epoch(mon, ep, &in) < 0) {
+            fprintf(stderr, "[%d:%u:%u] Warning: Failed to record the epoch\n", i, mon->tgid, mon->tid);
+        }
+
+        double emul_delay = mon->model->delay(emul, i, mon, &in);
+        DEBUG_PRINT("[%d:%u:%u] %s: delay=%lf\n", i, mon->tgid, mon->tid, mon->model->name, emul_delay);
+
+        /* compensation of delay END(1) */
+        clock_gettime(CLOCK_MONOTONIC, &end_ts);
+        *diff_nsec += elapsed_nsec(&start_ts, &end_ts);
+        DEBUG_PRINT("dif:%'12lu\n", *diff_nsec);
+
+        // The fraction of a nsec is carried to the next epochs, as well as
+        // the overhead exceeding the delay. The credit is limited to an
+        // epoch, so that an idle phase does not hide the delays of a later
+        // phase.
+        mon->delay_carry += emul_delay - (double)*diff_nsec;
+        double max_credit = (double)mon_time_to_nsec(&waittime);
+        if (mon->delay_carry < -max_credit) {
+            mon->delay_carry = -max_credit;
+        }
+        uint64_t calibrated_delay = 0;
+        if (mon->delay_carry >= 1) {
+            calibrated_delay = (uint64_t)mon->delay_carry;
+            mon->delay_carry -= (double)calibrated_delay;
+        }
+        mon->total_delay += (double)calibrated_delay / 1000000000;
+        *diff_nsec = 0;
+
+#ifndef ONLY_CALCULATION
+        /* insert emulated NVM latency */
+        add_mon_time(&mon->injected_delay, calibrated_delay);
+        DEBUG_PRINT("[%d:%u:%u]delay:%'10lu , total delay:%'lf\n", i, mon->tgid, mon->tid, calibrated_delay, mon->total_delay);
+#endif
+        swap        = mon->before;
+        mon->before = mon->after;
+        mon->after  = swap;
+
+#ifndef ONLY_CALCULATION
+        /* continue suspended processes: send SIGCONT */
+        // unfreeze_counters_cbo_all(fds.msr[0]);
+        // start_pmc(&fds, i);
+        if (calibrated_delay == 0) {
+            clear_mon_time(&mon->wasted_delay);
+            clear_mon_time(&mon->injected_delay);
+            run_mon(mon);
+        } else if (emul->sched != NULL) {
+            /*
+             * Only resume_due_mons() resumes the monitor. The wasted and
+             * squabble times below are of the epoch-driven resumption.
+             */
+            schedule_resume(emul->sched, i, &end_ts, calibrated_delay);
+            return;
+        }
+#endif
+
+    } else if (mon->status == MONITOR_OFF) {
+        // Wasted epoch time
+        clock_gettime(CLOCK_MONOTONIC, &start_ts);
+        uint64_t sleep_diff = elapsed_nsec(&ep->start_ts, &ep->end_ts);
+        struct timespec sleep_time;
+        sleep_time.tv_sec = sleep_diff / 1000000000;
+        sleep_time.tv_nsec = sleep_diff % 1000000000;
+        add_mon_time(&mon->wasted_delay, sleep_diff);
+        DEBUG_PRINT("[%d:%u:%u][OFF] total: %'lu | wasted : %'lu | waittime : %'lu | squabble : %'lu\n", \
+                    i, mon->tgid, mon->tid, mon->injected_delay.tv_nsec, mon->wasted_delay.tv_nsec, waittime.tv_nsec, mon->squabble_delay.tv_nsec);
+        if(check_continue_mon(i, emul->mons, sleep_time)) {
+            clear_mon_time(&mon->wasted_delay);
+            clear_mon_time(&mon->injected_delay);
+            run_mon(mon);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end_ts);
+        *diff_nsec += elapsed_nsec(&start_ts, &end_ts);
+    }
+
+    if(mon->status == MONITOR_OFF && (mon->injected_delay.tv_sec != 0 || mon->injected_delay.tv_nsec != 0)) {
+        int64_t remain_time = (int64_t)mon_time_to_nsec(&mon->injected_delay) - (int64_t)mon_time_to_nsec(&mon->wasted_delay);
+        /* do we need to get squabble time ? */
+        if (mon->wasted_delay.tv_sec >= waittime.tv_sec && \
+            remain_time < waittime.tv_nsec) {
+                mon->squabble_delay.tv_nsec += remain_time;
+                if (mon->squabble_delay.tv_nsec < 40000000) {
+                    DEBUG_PRINT("[SQ]total: %'lu | wasted : %'lu | waittime : %'lu | squabble : %'lu\n", \
+                                mon->injected_delay.tv_nsec, mon->wasted_delay.tv_nsec, waittime.tv_nsec, mon->squabble_delay.tv_nsec);
+                    clear_mon_time(&mon->wasted_delay);
+                    clear_mon_time(&mon->injected_delay);
+                    run_mon(mon);
+                } else {
+                    add_mon_time(&mon->injected_delay, mon->squabble_delay.tv_nsec);
+                    clear_mon_time(&mon->squabble_delay);
+                }
+        }
+    }
+}
+
+/*
+ * Process one epoch of all the monitors in the calling thread. ring is used
+ * to read the snapshot if it is not NULL.
+ */
+void emul_epoch(const struct __emul *emul, const struct __epoch *ep, uint64_t *diff_nsec, struct __uring *ring)
+{
+    uint32_t k, n = nr_active_mons();
+
+    for (k = 0; k < n; k++) {
+        emul_mon_stop(emul, active_mon(k));
+    }
+    read_snapshot_part(emul->pmu, emul->snap, 0, 1, ring);
+    pebs_drain_cpus(0, 1);
+    sum_snapshot(emul->snap);
+    for (k = 0; k < n; k++) {
+        emul_mon_epoch(emul, active_mon(k), ep, diff_nsec);
+    }
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#ifndef __EMUL_H
+#define __EMUL_H
+#include "types.h"
+#include "monitor.h"
+#include "uring.h"
+#include "resume.h"
+
+/* Parameters of the emulation. They are not changed after the start. */
+struct __emul {
+    int ncpu;
+    int ncbo;
+    uint32_t tnum;
+    struct __monitor *mons;
+    struct __pmu_info *pmu;
+    struct __snapshot *snap;
+    double cpu_freq;
+    double weight;
+    double dram_latency;
+    double remote_latency;          /* 0 unless the remote NUMA node is emulated */
+    struct emul_nvm_latency *emul_nvm_lats;
+    struct emul_nvm_bandwidth *emul_nvm_bws;    /* NULL if the bandwidth is not limited */
+    struct timespec waittime;
+    struct __resume_sched *sched;   /* NULL if stopped monitors are resumed at epochs */
+};
+
+/* The period of the current epoch: from the previous wake-up to this one. */
+struct __epoch {
+    struct timespec start_ts;
+    struct timespec end_ts;
+};
+
+void emul_mon_stop(const struct __emul *, const int);
+void emul_mon_epoch(const struct __emul *, const int, const struct __epoch *, uint64_t *);
+void emul_epoch(const struct __emul *, const struct __epoch *, uint64_t *, struct __uring *);
+#endif
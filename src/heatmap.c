@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "heatmap.h"
+#include "common.h"
+
+#define HEATMAP_INIT_SLOTS (1 << 16)
+
+/*
+ * An open-addressing hash table keyed by (tgid, page). Only the touched
+ * pages take a slot, so that a few hundreds of GB of memory can be tracked.
+ */
+struct __heatmap_table {
+    uint64_t mask;          /* the number of the slots - 1 */
+    uint64_t n;             /* the number of the used slots */
+    struct __heatmap_entry *entries;
+};
+
+/*
+ * Samples are added by the threads parsing PEBS buffers, and the table is
+ * swapped with the spare one at a dump. The lock protects cur.
+ */
+static struct {
+    FILE *fp;
+    int page_shift;
+    pthread_mutex_t lock;
+    struct __heatmap_table tables[2];
+    struct __heatmap_table *cur;
+    struct __heatmap_table *spare;
+} heatmap = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static inline uint64_t hash_page(const uint32_t tgid, const uint64_t page)
+{
+    return (page * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)tgid * 0xc2b2ae3d27d4eb4fULL);
+}
+
+static void init_table(struct __heatmap_table *t, const uint64_t nslots)
+{
+    t->mask = nslots - 1;
+    t->n = 0;
+    t->entries = (struct __heatmap_entry *)calloc(sizeof(struct __heatmap_entry), nslots);
+    if (t->entries == NULL) {
+        handle_error("calloc");
+    }
+}
+
+static struct __heatmap_entry *find_slot(struct __heatmap_table *t, const uint32_t tgid, const uint64_t page)
+{
+    uint64_t i;
+
+    for (i = hash_page(tgid, page) & t->mask; ; i = (i + 1) & t->mask) {
+        struct __heatmap_entry *e = &t->entries[i];
+        if (e->count == 0 || (e->page == page && e->tgid == tgid)) {
+            return e;
+        }
+    }
+}
+
+/* Double the slots when the half is used. */
+static void grow_table(struct __heatmap_table *t)
+{
+    struct __heatmap_table old = *t;
+    uint64_t i;
+
+    init_table(t, (old.mask + 1) * 2);
+    for (i = 0; i <= old.mask; i++) {
+        if (old.entries[i].count > 0) {
+            *find_slot(t, old.entries[i].tgid, old.entries[i].page) = old.entries[i];
+            t->n++;
+        }
+    }
+    free(old.entries);
+}
+
+/* Record samples to path. page_shift is 12 (4 KiB) or 21 (2 MiB). */
+int init_heatmap(const char *path, const int page_shift)
+{
+    struct __heatmap_header header = {
+        .magic = HEATMAP_MAGIC,
+        .version = HEATMAP_VERSION,
+        .page_shift = page_shift,
+    };
+
+    heatmap.fp = fopen(path, "wb");
+    if (heatmap.fp == NULL) {
+        perror("fopen");
+        return -1;
+    }
+    if (fwrite(&header, sizeof(header), 1, heatmap.fp) != 1) {
+        perror("fwrite");
+        fclose(heatmap.fp);
+        heatmap.fp = NULL;
+        return -1;
+    }
+    heatmap.page_shift = page_shift;
+    init_table(&heatmap.tables[0], HEATMAP_INIT_SLOTS);
+    init_table(&heatmap.tables[1], HEATMAP_INIT_SLOTS);
+    heatmap.cur = &heatmap.tables[0];
+    heatmap.spare = &heatmap.tables[1];
+    return 0;
+}
+
+/* Dump the rest of the counts and close the file. */
+void fini_heatmap(void)
+{
+    struct timespec ts;
+
+    if (heatmap.fp == NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    dump_heatmap(&ts);
+    fclose(heatmap.fp);
+    heatmap.fp = NULL;
+    free(heatmap.tables[0].entries);
+    free(heatmap.tables[1].entries);
+}
+
+bool heatmap_enabled(void)
+{
+    return heatmap.fp != NULL;
+}
+
+/* Count n samples at the virtual addresses of the processes. */
+void heatmap_add(const uint32_t *tgid, const uint64_t *addr, const int n)
+{
+    int k;
+
+    if (heatmap.fp == NULL || n == 0) {
+        return;
+    }
+    pthread_mutex_lock(&heatmap.lock);
+    for (k = 0; k < n; k++) {
+        struct __heatmap_entry *e;
+        uint64_t page = addr[k] >> heatmap.page_shift;
+
+        e = find_slot(heatmap.cur, tgid[k], page);
+        if (e->count == 0) {
+            e->page = page;
+            e->tgid = tgid[k];
+            if (++heatmap.cur->n * 2 > heatmap.cur->mask + 1) {
+                e->count = 1;
+                grow_table(heatmap.cur);
+                continue;
+            }
+        }
+        if (e->count < UINT32_MAX) {
+            e->count++;
+        }
+    }
+    pthread_mutex_unlock(&heatmap.lock);
+}
+
+/*
+ * Append the counts since the last dump as a frame. The samples coming in
+ * meanwhile go to the other table.
+ */
+int dump_heatmap(const struct timespec *ts)
+{
+    struct __heatmap_table *t;
+    struct __heatmap_frame frame;
+    uint64_t i;
+
+    if (heatmap.fp == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&heatmap.lock);
+    t = heatmap.cur;
+    heatmap.cur = heatmap.spare;
+    heatmap.spare = t;
+    pthread_mutex_unlock(&heatmap.lock);
+
+    frame.time_ns = (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+    frame.nentries = t->n;
+    if (fwrite(&frame, sizeof(frame), 1, heatmap.fp) != 1) {
+        perror("fwrite");
+        return -1;
+    }
+    for (i = 0; i <= t->mask; i++) {
+        if (t->entries[i].count == 0) {
+            continue;
+        }
+        if (fwrite(&t->entries[i], sizeof(struct __heatmap_entry), 1, heatmap.fp) != 1) {
+            perror("fwrite");
+            return -1;
+        }
+        t->entries[i].count = 0;
+    }
+    t->n = 0;
+    return fflush(heatmap.fp) == 0 ? 0 : -1;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#ifndef __HEATMAP_H
+#define __HEATMAP_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * The number of PEBS samples of each page of each process. The counts
+ * since the last dump are appended to a file as a frame:
+ *
+ *   file:  struct __heatmap_header, then frames
+ *   frame: struct __heatmap_frame, then nentries of struct __heatmap_entry
+ *
+ * All the fields are in the byte order of the host.
+ */
+#define HEATMAP_MAGIC "MESHEAT"
+#define HEATMAP_VERSION 1
+#define HEATMAP_INTERVAL_SEC 1
+
+struct __heatmap_header {
+    char magic[8];          /* HEATMAP_MAGIC */
+    uint32_t version;
+    uint32_t page_shift;    /* 12 for 4 KiB pages, 21 for 2 MiB pages */
+};
+
+struct __heatmap_frame {
+    uint64_t time_ns;       /* CLOCK_MONOTONIC at the dump */
+    uint64_t nentries;
+};
+
+struct __heatmap_entry {
+    uint64_t page;          /* the virtual address >> page_shift */
+    uint32_t tgid;
+    uint32_t count;         /* 0 for an empty slot of the hash table */
+};
+
+int init_heatmap(const char *, const int);
+void fini_heatmap(void);
+bool heatmap_enabled(void);
+void heatmap_add(const uint32_t *, const uint64_t *, const int);
+int dump_heatmap(const struct timespec *);
+#endif
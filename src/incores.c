@@ -9,6 +9,11 @@
 #include "common.h"
 #include <string.h>
 
+/* count the LLC misses served by the remote NUMA node, see incore_enable_remote() */
+static bool incore_remote = false;
+/* count the offcore outstanding requests, see incore_enable_load() */
+static bool incore_load = false;
+
 void pcm_cpuid(const unsigned leaf, CPUID_INFO* info)
 {
     __asm__ __volatile__ ("cpuid" : \
@@ -111,13 +116,20 @@ int start_pmc(struct __incore *inc)
 {
     int i, r;
 
-    for (i = 0; i < 4; i++) {
+    for (i = 0; i < inc->nevents; i++) {
         r = perf_start(&inc->perf[i]);
         if (r < 0) {
             fprintf(stderr, "%s perf_start failed. i:%d\n", __func__, i);
             return r;
         }
     }
+    for (i = 0; i < inc->nload; i++) {
+        r = perf_start(&inc->load[i]);
+        if (r < 0) {
+            fprintf(stderr, "%s perf_start of the load group failed. i:%d\n", __func__, i);
+            return r;
+        }
+    }
     return r;
 }
 
@@ -125,17 +137,29 @@ int stop_pmc(struct __incore *inc)
 {
     int i, r = -1;
 
-    for (i = 0; i < 4; i++) {
+    for (i = 0; i < inc->nevents; i++) {
         r = perf_stop(&inc->perf[i]);
         if (r < 0) {
             fprintf(stderr, "%s perf_stop failed. i:%d\n", __func__, i);
             return r;
         }
     }
+    for (i = 0; i < inc->nload; i++) {
+        r = perf_stop(&inc->load[i]);
+        if (r < 0) {
+            fprintf(stderr, "%s perf_stop of the load group failed. i:%d\n", __func__, i);
+            return r;
+        }
+    }
     return r;
 }
 
-static int init_incore_perf(struct __perf_info *perf, const pid_t pid, const int cpu, uint64_t conf, uint64_t conf1)
+/*
+ * Open an in-core event. It joins the group of group_fd, or it becomes a
+ * group leader read with PERF_FORMAT_GROUP if leader is true.
+ */
+static int open_incore_perf(struct __perf_info *perf, const int group_fd, const bool leader,
+                            const pid_t pid, const int cpu, uint64_t conf, uint64_t conf1)
 {
     int r;
 
@@ -147,7 +171,7 @@ static int init_incore_perf(struct __perf_info *perf, const pid_t pid, const int
         perf->cpu = -1;
     }
 
-    perf->group_fd         = -1;
+    perf->group_fd         = group_fd;
     perf->flags            = 0x08;
     memset(&perf->attr, 0, sizeof(perf->attr));
     perf->attr.type        = PERF_TYPE_RAW;
@@ -155,7 +179,16 @@ static int init_incore_perf(struct __perf_info *perf, const pid_t pid, const int
     perf->attr.config      = conf;
     perf->attr.config1     = conf1;
     perf->attr.disabled    = 1;
-    perf->attr.inherit     = 1;
+    /* each thread is counted by its own events in the per-thread mode */
+    perf->attr.inherit     = (perf->pid == -1) ? 1 : 0;
+    if (leader) {
+        perf->attr.read_format = PERF_FORMAT_GROUP;
+    }
+    if (perf->pid != -1) {
+        /* the thread shares the counters of the cores, see read_incore() */
+        perf->attr.read_format |= PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    }
+    memset(&perf->scale, 0, sizeof(perf->scale));
 
     r = perf_init(perf);
     if (r < 0) {
@@ -168,32 +201,50 @@ static int init_incore_perf(struct __perf_info *perf, const pid_t pid, const int
 
 }
 
+/*
+ * Open an in-core event. When the events of the core are grouped, the
+ * first event becomes the group leader and the others join its group.
+ */
+static int init_incore_perf(struct __incore *inc, const int idx, const pid_t pid, const int cpu, uint64_t conf, uint64_t conf1)
+{
+    return open_incore_perf(&inc->perf[idx],
+                            (inc->grouped && idx != INCORE_ALL_DRAM_RDS) ? inc->perf[INCORE_ALL_DRAM_RDS].fd : -1,
+                            inc->grouped && idx == INCORE_ALL_DRAM_RDS,
+                            pid, cpu, conf, conf1);
+}
+
 int init_all_dram_rds(struct __incore *inc, const pid_t pid, const int cpu)
 {
-    return init_incore_perf(&inc->perf[0], pid, cpu,
+    return init_incore_perf(inc, INCORE_ALL_DRAM_RDS, pid, cpu,
                             perf_config.all_dram_rds_config,
                             perf_config.all_dram_rds_config1);
 }
 
 int init_cpu_l2stall(struct __incore *inc, const pid_t pid, const int cpu)
 {
-    return init_incore_perf(&inc->perf[1], pid, cpu,
+    return init_incore_perf(inc, INCORE_L2STALL, pid, cpu,
                             perf_config.cpu_l2stall_config, 0);
 }
 
 int init_cpu_llcl_hits(struct __incore *inc, const pid_t pid, const int cpu)
 {
-    return init_incore_perf(&inc->perf[2], pid, cpu,
+    return init_incore_perf(inc, INCORE_LLCL_HITS, pid, cpu,
                             perf_config.cpu_llcl_hits_config, 0);
 }
 
 int init_cpu_llcl_miss(struct __incore *inc, const pid_t pid, const int cpu)
 {
-    return init_incore_perf(&inc->perf[3], pid, cpu,
+    return init_incore_perf(inc, INCORE_LLCL_MISS, pid, cpu,
                             perf_config.cpu_llcl_miss_config, 0);
 }
 
-int init_pmc(struct __incore *inc, const pid_t pid, const int cpu)
+int init_cpu_llcr_miss(struct __incore *inc, const pid_t pid, const int cpu)
+{
+    return init_incore_perf(inc, INCORE_LLCR_MISS, pid, cpu,
+                            perf_config.cpu_llcr_miss_config, 0);
+}
+
+static int init_pmc_events(struct __incore *inc, const pid_t pid, const int cpu)
 {
     int r;
 
@@ -222,18 +273,97 @@ int init_pmc(struct __incore *inc, const pid_t pid, const int cpu)
         return r;
     }
 
+    if (inc->nevents > INCORE_LLCR_MISS) {
+        r = init_cpu_llcr_miss(inc, pid, cpu);
+        if (r < 0) {
+            fprintf(stderr, "%s init_cpu_llcr_miss failed cpu:%d\n", __func__, cpu);
+            return r;
+        }
+    }
+
     return r;
 }
 
+/*
+ * Open the load group of the core. It is optional: if the core has no
+ * counters left for the group, the load curve is not applied to the core.
+ */
+static void init_pmc_load(struct __incore *inc, const pid_t pid, const int cpu)
+{
+    int i;
+
+    inc->nload = 0;
+    if (!incore_load) {
+        return;
+    }
+    if (open_incore_perf(&inc->load[INCORE_OFFCORE_OCC], -1, true, pid, cpu,
+                         perf_config.cpu_offcore_occ_config, 0) < 0) {
+        goto err;
+    }
+    if (open_incore_perf(&inc->load[INCORE_OFFCORE_CYC], inc->load[INCORE_OFFCORE_OCC].fd, false, pid, cpu,
+                         perf_config.cpu_offcore_cyc_config, 0) < 0) {
+        perf_fini(&inc->load[INCORE_OFFCORE_OCC]);
+        goto err;
+    }
+    inc->nload = INCORE_NR_LOAD_EVENTS;
+    return;
+
+err:
+    fprintf(stderr, "%s failed to open the load group, the load curve is not applied. cpu:%d\n", __func__, cpu);
+    for (i = 0; i < INCORE_NR_LOAD_EVENTS; i++) {
+        inc->load[i].fd = -1;
+    }
+}
+
+int init_pmc(struct __incore *inc, const pid_t pid, const int cpu)
+{
+    int i, r;
+
+    for (i = 0; i < INCORE_NR_EVENTS; i++) {
+        inc->perf[i].fd = -1;
+    }
+    inc->nevents = incore_remote ? INCORE_NR_EVENTS : INCORE_LLCR_MISS;
+
+    /* read the events atomically in a single read() */
+    inc->grouped = true;
+    r = init_pmc_events(inc, pid, cpu);
+    if (r < 0) {
+        /* e.g., not enough counters for the group. open them separately. */
+        fprintf(stderr, "%s failed to open the event group, fall back to separate events. cpu:%d\n", __func__, cpu);
+        for (i = 0; i < inc->nevents; i++) {
+            perf_fini(&inc->perf[i]);
+        }
+        inc->grouped = false;
+        r = init_pmc_events(inc, pid, cpu);
+        if (r < 0) {
+            return r;
+        }
+    }
+    init_pmc_load(inc, pid, cpu);
+
+    if (inc->rdpmc) {
+        for (i = 0; i < inc->nevents + inc->nload; i++) {
+            if (perf_mmap(i < inc->nevents ? &inc->perf[i] : &inc->load[i - inc->nevents]) < 0) {
+                fprintf(stderr, "%s rdpmc is not available, fall back to read(). cpu:%d\n", __func__, cpu);
+                inc->rdpmc = false;
+                break;
+            }
+        }
+    }
+    return r;
+}
 
 void fini_pmc(struct __incore *inc)
 {
     int i;
 
     stop_pmc(inc);
-    for (i = 0; i < 4; i++) {
+    for (i = 0; i < inc->nevents; i++) {
         perf_fini(&inc->perf[i]);
     }
+    for (i = 0; i < inc->nload; i++) {
+        perf_fini(&inc->load[i]);
+    }
 }
 
 int init_all_pmcs(struct __pmu_info *pmu, const pid_t pid)
@@ -248,6 +378,7 @@ int init_all_pmcs(struct __pmu_info *pmu, const pid_t pid)
     }
 
     for (i = 0; i < n; i++) {
+        pmu->cpus[i].rdpmc = pmu->rdpmc;
         r = init_pmc(&pmu->cpus[i], pid, i);
         if (r < 0) {
             fprintf(stderr, "%s init_pmc failed cpu:%d\n", __func__, i);
@@ -272,37 +403,177 @@ void fini_all_pmcs(struct __pmu_info *pmu)
     free(pmu->cpus);
 }
 
+static bool multiplex_warned = false;
+
+static void warn_multiplexed(const struct __perf_info *perf, const bool multiplexed)
+{
+    if (!multiplexed) {
+        return;
+    }
+    DEBUG_PRINT("the events of pid:%d are time-multiplexed\n", perf->pid);
+    if (!multiplex_warned) {
+        multiplex_warned = true;
+        fprintf(stderr, "Warning: the in-core events of the threads are time-multiplexed by the kernel, "
+                "and their counts are scaled. pid:%d\n", perf->pid);
+    }
+}
+
+/*
+ * Read an in-core event. The events of a thread share the counters of the
+ * cores with the per-CPU events and the other threads, and the kernel
+ * multiplexes them in time. Their counts are then scaled by perf_scale().
+ */
+static ssize_t read_incore(struct __perf_info *perf, uint64_t *value)
+{
+    uint64_t enabled, running;
+    ssize_t r;
+
+    if (!(perf->attr.read_format & PERF_FORMAT_TOTAL_TIME_RUNNING)) {
+        return perf_read_pmu(perf, value);
+    }
+    r = perf_read_pmu_times(perf, value, &enabled, &running);
+    if (r < 0) {
+        return r;
+    }
+    warn_multiplexed(perf, perf_scale(perf, value, enabled, running));
+    return r;
+}
+
+/* read_incore() of the group of the n events of perf[], led by perf[0] */
+static ssize_t read_incore_group(struct __perf_info *perf, uint64_t *values, const int n)
+{
+    uint64_t enabled, running;
+    bool multiplexed = false;
+    ssize_t r;
+    int i;
+
+    if (!(perf->attr.read_format & PERF_FORMAT_TOTAL_TIME_RUNNING)) {
+        return perf_read_group(perf, values, n);
+    }
+    r = perf_read_group_times(perf, values, n, &enabled, &running);
+    if (r < 0) {
+        return r;
+    }
+    for (i = 0; i < n; i++) {
+        multiplexed |= perf_scale(&perf[i], &values[i], enabled, running);
+    }
+    warn_multiplexed(perf, multiplexed);
+    return r;
+}
+
+/* Read the load group of the core, if it is opened. */
+static int read_load_elems(struct __incore *inc, struct __cpu_elem *elem)
+{
+    uint64_t values[INCORE_NR_LOAD_EVENTS];
+
+    if (inc->nload == 0) {
+        return 0;
+    }
+    if (read_incore_group(inc->load, values, inc->nload) < 0) {
+        fprintf(stderr, "%s read the load group failed.\n", __func__);
+        return -1;
+    }
+    elem->cpu_offcore_occ = values[INCORE_OFFCORE_OCC];
+    elem->cpu_offcore_cyc = values[INCORE_OFFCORE_CYC];
+    DEBUG_PRINT("read cpu_offcore_occ:%lu cpu_offcore_cyc:%lu\n", elem->cpu_offcore_occ, elem->cpu_offcore_cyc);
+    return 0;
+}
+
 int read_cpu_elems(struct __incore *inc, struct __cpu_elem *elem)
 {
     ssize_t r;
 
-    r = perf_read_pmu(&inc->perf[0], &elem->all_dram_rds);
+    if (inc->rdpmc && perf_can_rdpmc(&inc->perf[INCORE_ALL_DRAM_RDS])) {
+        /* on the CPU core of the events: no system call is needed */
+        perf_read_rdpmc(&inc->perf[INCORE_ALL_DRAM_RDS], &elem->all_dram_rds);
+        perf_read_rdpmc(&inc->perf[INCORE_L2STALL], &elem->cpu_l2stall_t);
+        perf_read_rdpmc(&inc->perf[INCORE_LLCL_HITS], &elem->cpu_llcl_hits);
+        perf_read_rdpmc(&inc->perf[INCORE_LLCL_MISS], &elem->cpu_llcl_miss);
+        if (inc->nevents > INCORE_LLCR_MISS) {
+            perf_read_rdpmc(&inc->perf[INCORE_LLCR_MISS], &elem->cpu_llcr_miss);
+        }
+        if (inc->nload > 0) {
+            perf_read_rdpmc(&inc->load[INCORE_OFFCORE_OCC], &elem->cpu_offcore_occ);
+            perf_read_rdpmc(&inc->load[INCORE_OFFCORE_CYC], &elem->cpu_offcore_cyc);
+        }
+        return 0;
+    }
+
+    if (inc->grouped) {
+        uint64_t values[INCORE_NR_EVENTS];
+
+        r = read_incore_group(inc->perf, values, inc->nevents);
+        if (r < 0) {
+            fprintf(stderr, "%s read the event group failed.\n", __func__);
+            return r;
+        }
+        elem->all_dram_rds  = values[INCORE_ALL_DRAM_RDS];
+        elem->cpu_l2stall_t = values[INCORE_L2STALL];
+        elem->cpu_llcl_hits = values[INCORE_LLCL_HITS];
+        elem->cpu_llcl_miss = values[INCORE_LLCL_MISS];
+        if (inc->nevents > INCORE_LLCR_MISS) {
+            elem->cpu_llcr_miss = values[INCORE_LLCR_MISS];
+        }
+        DEBUG_PRINT("read all_dram_rds:%lu cpu_l2stall_t:%lu cpu_llcl_hits:%lu cpu_llcl_miss:%lu\n",
+                    elem->all_dram_rds, elem->cpu_l2stall_t, elem->cpu_llcl_hits, elem->cpu_llcl_miss);
+        return read_load_elems(inc, elem);
+    }
+
+    r = read_incore(&inc->perf[INCORE_ALL_DRAM_RDS], &elem->all_dram_rds);
     if (r < 0) {
         fprintf(stderr, "%s read all_dram_rds failed.\n", __func__);
         return r;
     }
     DEBUG_PRINT("read all_dram_rds:%lu\n", elem->all_dram_rds);
 
-    r = perf_read_pmu(&inc->perf[1], &elem->cpu_l2stall_t);
+    r = read_incore(&inc->perf[INCORE_L2STALL], &elem->cpu_l2stall_t);
     if (r < 0) {
         fprintf(stderr, "%s read cpu_l2stall_t failled.\n", __func__);
         return r;
     }
     DEBUG_PRINT("read cpu_l2stall_t:%lu\n", elem->cpu_l2stall_t);
 
-    r = perf_read_pmu(&inc->perf[2], &elem->cpu_llcl_hits);
+    r = read_incore(&inc->perf[INCORE_LLCL_HITS], &elem->cpu_llcl_hits);
     if (r < 0) {
         fprintf(stderr, "%s read cpu_llcl_hits failed.\n", __func__);
         return r;
     }
     DEBUG_PRINT("read cpu_llcl_hits:%lu\n", elem->cpu_llcl_hits);
 
-    r = perf_read_pmu(&inc->perf[3], &elem->cpu_llcl_miss);
+    r = read_incore(&inc->perf[INCORE_LLCL_MISS], &elem->cpu_llcl_miss);
     if (r < 0) {
         fprintf(stderr, "%s read cpu_llcl_miss failed.\n", __func__);
         return r;
     }
     DEBUG_PRINT("read cpu_llcl_miss:%lu\n", elem->cpu_llcl_miss);
 
-    return 0;
+    if (inc->nevents > INCORE_LLCR_MISS) {
+        r = read_incore(&inc->perf[INCORE_LLCR_MISS], &elem->cpu_llcr_miss);
+        if (r < 0) {
+            fprintf(stderr, "%s read cpu_llcr_miss failed.\n", __func__);
+            return r;
+        }
+        DEBUG_PRINT("read cpu_llcr_miss:%lu\n", elem->cpu_llcr_miss);
+    }
+
+    return read_load_elems(inc, elem);
+}
+
+/*
+ * Also count the LLC misses served by the remote NUMA node. It is called
+ * before any in-core events are opened.
+ */
+void incore_enable_remote(void)
+{
+    incore_remote = true;
+}
+
+/*
+ * Also count the outstanding offcore data reads of the cores, i.e., the
+ * load of the memory, for the load curve. It is called before any in-core
+ * events are opened.
+ */
+void incore_enable_load(void)
+{
+    incore_load = true;
 }
@@ -23,10 +23,13 @@ int init_all_dram_rds(struct __incore *inc, const pid_t pid, const int cpu);
 int init_cpu_l2stall(struct __incore *inc, const pid_t pid, const int cpu);
 int init_cpu_llcl_hits(struct __incore *inc, const pid_t pid, const int cpu);
 int init_cpu_llcl_miss(struct __incore *inc, const pid_t pid, const int cpu);
+int init_cpu_llcr_miss(struct __incore *inc, const pid_t pid, const int cpu);
 int init_pmc(struct __incore *inc, const pid_t pid, const int cpu);
 void fini_pmc(struct __incore *inc);
 int init_all_pmcs(struct __pmu_info *pmu, const pid_t pid);
 void fini_all_pmcs(struct __pmu_info *pmu);
 int read_cpu_elems(struct __incore *inc, struct __cpu_elem *cpu_elem);
+void incore_enable_remote(void);
+void incore_enable_load(void);
 
 #endif
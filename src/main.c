@@ -25,7 +25,6 @@
 #include <errno.h>
 
 // #define DEBUG
-// #define ONLY_CALCULATION	// not inserting the calculated delay to processes
 
 #include "common.h"
 #include "types.h"
@@ -33,6 +32,16 @@
 #include "uncores.h"
 #include "incores.h"
 #include "pebs.h"
+#include "snapshot.h"
+#include "emul.h"
+#include "workers.h"
+#include "timer.h"
+#include "resume.h"
+#include "control.h"
+#include "trace.h"
+#include "replay.h"
+#include "heatmap.h"
+#include "media.h"
 
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -61,11 +70,16 @@ detach_children(void)
 
 int main(int argc, char **argv)
 {
-    int i, j, ret;
-    struct __elem *swap;
+    /* the offline replay of a trace does not need the PMUs */
+    if (argc >= 2 && strcmp(argv[1], "replay") == 0) {
+        return replay_main(argc - 1, &argv[1]);
+    }
+
+    int i, j;
     struct __monitor *mons;
     struct __monitor *mon;
     struct __pmu_info pmu;
+    struct __snapshot snap;
     int cur_processes = 0;                    // total number of executed application exectued by mesmerics
     pid_t t_process = 0;
     int ncpu = num_of_cpu();
@@ -73,20 +87,37 @@ int main(int argc, char **argv)
     uint32_t intrval = 20; // default is 20ms
     uint32_t tnum = ncpu;  // default is num of cpu
     uint64_t pebs_sample_period = 1;
+    bool pebs_adaptive = false;
     uint64_t use_cpus = 0;
     cpu_set_t use_cpuset;
     CPU_ZERO(&use_cpuset);
     /* calculate nvm latency */
     double dram_latency = 85.7; // default: Broadwell Xeon (Gen 5). XEON_E5_2654_V4
     double weight = 4.2;        // default: Broadwell Xeon (Gen 5). XEON_E5_2654_V4
+    double remote_latency = 0;  // default: the remote NUMA node is not emulated
     double cpu_freq = cpu_frequency();
     bool oneshot = false;
+    int nworkers = 0;           // default: process all the monitors in the main thread
+    bool use_rdpmc = false;
+    bool use_uring = false;
+    bool use_deadline = false;
+    bool multiplex = false;
+    bool pebs_drain = false;
+    bool pebs_percpu = false;
+    uint32_t maxthreads = 1024; // default with multiplex
 
     setlocale(LC_NUMERIC, "");
 
     char* target_path = NULL;
     char* target_argv[128];
     int target_argc = 1;
+    char *heatmap_path = NULL;
+    char *trace_path = NULL;
+    int heatmap_shift = 12;     // default: 4 KiB pages
+    struct __region_info phys_ranges[128];
+    int nphys = 0;
+    struct emul_nvm_bandwidth bw_limits[128];
+    int nbw = 0;
 
     /* get args */
     struct option longopts[] = {
@@ -99,12 +130,31 @@ int main(int argc, char **argv)
         { "weight",     required_argument, NULL, 'w' },
         { "cpufreq",    required_argument, NULL, 'f' },
         { "oneshot",    no_argument,       NULL, 'o' },
+        { "workers",    required_argument, NULL, 'j' },
+        { "rdpmc",      no_argument,       NULL, 'r' },
+        { "uring",      no_argument,       NULL, 'u' },
+        { "deadline",   no_argument,       NULL, 'd' },
+        { "multiplex",  no_argument,       NULL, 'm' },
+        { "maxthreads", required_argument, NULL, 'n' },
+        { "pebspages",  required_argument, NULL, 'b' },
+        { "pebsdrain",  no_argument,       NULL, 'D' },
+        { "pebspercpu", no_argument,       NULL, 'C' },
+        { "stores",     no_argument,       NULL, 's' },
+        { "physrange",  required_argument, NULL, 'P' },
+        { "numa",       required_argument, NULL, 'N' },
+        { "pebstarget", required_argument, NULL, 'A' },
+        { "heatmap",    required_argument, NULL, 'H' },
+        { "hugepage",   no_argument,       NULL, 'g' },
+        { "media",      required_argument, NULL, 'x' },
+        { "bandwidth",  required_argument, NULL, 'B' },
+        { "loadcurve",  required_argument, NULL, 'q' },
+        { "trace",      required_argument, NULL, 'O' },
         { 0,        0,                 0,     0  },
     };
     bool usage = false;
     int opt;
     int longindex;
-    while ((opt = getopt_long(argc, argv, "t:a:i:c:p:l:w:f:o", longopts, &longindex)) != -1) {
+    while ((opt = getopt_long(argc, argv, "t:a:i:c:p:l:w:f:oj:rudmn:b:DCsP:N:A:H:gx:B:q:O:", longopts, &longindex)) != -1) {
         switch (opt) {
             case 't':
                 target_path = optarg;
@@ -131,6 +181,33 @@ int main(int argc, char **argv)
                     usage = true;
                 }
                 break;
+            case 'A': {
+                uint64_t target_samples = (uint64_t)strtoull(optarg, NULL, 10);
+                DEBUG_PRINT("A:%s\n", optarg);
+                if (target_samples == 0) {
+                    usage = true;
+                }
+                pebs_set_target(target_samples);
+                pebs_adaptive = true;
+                break;
+            }
+            case 'H':
+                heatmap_path = optarg;
+                DEBUG_PRINT("H:%s\n", optarg);
+                break;
+            case 'g':
+                heatmap_shift = 21;
+                break;
+            case 'O':
+                trace_path = optarg;
+                DEBUG_PRINT("O:%s\n", optarg);
+                break;
+            case 'x':
+                DEBUG_PRINT("x:%s\n", optarg);
+                if (media_set_lines((int)strtol(optarg, NULL, 10)) < 0) {
+                    usage = true;
+                }
+                break;
             case 'l':
                 dram_latency = (double)strtod(optarg, NULL);
                 DEBUG_PRINT("s:%s\n", optarg);
@@ -138,6 +215,13 @@ int main(int argc, char **argv)
                     usage = true;
                 }
                 break;
+            case 'N':
+                remote_latency = (double)strtod(optarg, NULL);
+                DEBUG_PRINT("N:%s\n", optarg);
+                if (remote_latency <= 0) {
+                    usage = true;
+                }
+                break;
             case 'w':
                 weight = (double)strtod(optarg, NULL);
                 DEBUG_PRINT("w:%s\n", optarg);
@@ -155,6 +239,102 @@ int main(int argc, char **argv)
             case 'o':
                 oneshot = true;
                 break;
+            case 'j':
+                nworkers = (int)strtol(optarg, NULL, 10);
+                DEBUG_PRINT("j:%s\n", optarg);
+                if (nworkers < 0) {
+                    usage = true;
+                }
+                break;
+            case 'r':
+                use_rdpmc = true;
+                break;
+            case 'u':
+                use_uring = true;
+                break;
+            case 'd':
+                use_deadline = true;
+                break;
+            case 'm':
+                multiplex = true;
+                break;
+            case 'b':
+                DEBUG_PRINT("b:%s\n", optarg);
+                if (pebs_set_data_pages((int)strtol(optarg, NULL, 10)) < 0) {
+                    usage = true;
+                }
+                break;
+            case 'D':
+                pebs_drain = true;
+                break;
+            case 'C':
+                pebs_percpu = true;
+                break;
+            case 's':
+                pebs_enable_stores();
+                break;
+            case 'P': {
+                char *end;
+                DEBUG_PRINT("P:%s\n", optarg);
+                if (nphys == 128) {
+                    usage = true;
+                    break;
+                }
+                phys_ranges[nphys].addr = (uint64_t)strtoull(optarg, &end, 0);
+                if (*end != ',') {
+                    usage = true;
+                    break;
+                }
+                phys_ranges[nphys].size = (uint64_t)strtoull(end + 1, &end, 0);
+                if (*end != '\0' || phys_ranges[nphys].size == 0) {
+                    usage = true;
+                    break;
+                }
+                nphys++;
+                break;
+            }
+            case 'B': {
+                char *end;
+                DEBUG_PRINT("B:%s\n", optarg);
+                if (nbw == 128) {
+                    usage = true;
+                    break;
+                }
+                bw_limits[nbw].read = (double)strtod(optarg, &end);
+                if (*end != ',') {
+                    usage = true;
+                    break;
+                }
+                bw_limits[nbw].write = (double)strtod(end + 1, &end);
+                if (*end != '\0' || bw_limits[nbw].read < 0 || bw_limits[nbw].write < 0) {
+                    usage = true;
+                    break;
+                }
+                nbw++;
+                break;
+            }
+            case 'q': {
+                char *end;
+                double occupancy, factor;
+                DEBUG_PRINT("q:%s\n", optarg);
+                occupancy = (double)strtod(optarg, &end);
+                if (*end != ',') {
+                    usage = true;
+                    break;
+                }
+                factor = (double)strtod(end + 1, &end);
+                if (*end != '\0' || model_add_load_point(occupancy, factor) < 0) {
+                    usage = true;
+                }
+                break;
+            }
+            case 'n':
+                maxthreads = (uint32_t)strtoul(optarg, NULL, 10);
+                DEBUG_PRINT("n:%s\n", optarg);
+                if (maxthreads == 0) {
+                    usage = true;
+                }
+                break;
             default:
                 usage = true;
         }
@@ -165,7 +345,7 @@ int main(int argc, char **argv)
             DEBUG_PRINT("use cpuid: %d\n", i);
         }
     }
-    tnum = CPU_COUNT(&use_cpuset);
+    tnum = multiplex ? maxthreads : CPU_COUNT(&use_cpuset);
 
     DEBUG_PRINT("tnum:%u, intrval:%u\n", tnum, intrval);
     DEBUG_PRINT("dram_latency:%lf\n", dram_latency);
@@ -174,7 +354,8 @@ int main(int argc, char **argv)
     target_argv[target_argc] = NULL;
     i = argc - optind;
     if (usage || i <= 0 || (i % 2)) {
-        printf("Usage: mes [ -f ${CPU_FREQUENCY} ] [ -l ${LATENCY} ] [ -w ${WEIGHT} ] [-i ${EMUL_PERIOD_MS} ] [-c ${CPU_SET} ] [ -p ${PEBS_SAMPLING_PERIOD} ] [ -t ${TARGET_PATH} ] [ -a ${TARGET_ARGS} [ -a ...] ] ${ALPHA_RD_LAT_NS} ${ALPHAWR_LAT_NS} [ ${BETA_RD_LAT_NS} ${BETA_WR_LAT_NS} [...] ]\n");
+        printf("Usage: mes [ -f ${CPU_FREQUENCY} ] [ -l ${LATENCY} ] [ -w ${WEIGHT} ] [-i ${EMUL_PERIOD_MS} ] [-c ${CPU_SET} ] [ -p ${PEBS_SAMPLING_PERIOD} [ -A ${PEBS_SAMPLES_PER_EPOCH} ] ] [ -b ${PEBS_BUFFER_PAGES} ] [ -D ] [ -C ] [ -s ] [ -P ${PHYS_START},${PHYS_SIZE} [ -P ...] ] [ -N ${REMOTE_LATENCY} ] [ -H ${HEATMAP_PATH} [ -g ] ] [ -x ${MEDIA_BUFFER_LINES} ] [ -B ${READ_GBPS},${WRITE_GBPS} [ -B ...] ] [ -q ${OCCUPANCY},${FACTOR} [ -q ...] ] [ -O ${TRACE_PATH} ] [ -j ${NUM_OF_WORKERS} ] [ -r ] [ -u ] [ -d ] [ -m [ -n ${MAX_THREADS} ] ] [ -t ${TARGET_PATH} ] [ -a ${TARGET_ARGS} [ -a ...] ] ${ALPHA_RD_LAT_NS} ${ALPHAWR_LAT_NS} [ ${BETA_RD_LAT_NS} ${BETA_WR_LAT_NS} [...] ]\n");
+        printf("  -P emulates the physical ranges for the target of -t and the threads registered to the emulator only.\n");
         exit(0);
     }
     int nmem = i / 2;
@@ -187,13 +368,69 @@ int main(int argc, char **argv)
         emul_nvm_lats[j].read = (double)strtod(argv[i++], NULL);
         emul_nvm_lats[j].write = (double)strtod(argv[i++], NULL);
         DEBUG_PRINT("nvm%d: latency read:%lf, write:%lf\n", j, emul_nvm_lats[j].read, emul_nvm_lats[j].write);
-        if (emul_nvm_lats[j].read <= dram_latency || emul_nvm_lats[j].write <= dram_latency) {
+        if (emul_nvm_lats[j].read <= dram_latency || emul_nvm_lats[j].write <= dram_latency ||
+            emul_nvm_lats[j].read <= remote_latency || emul_nvm_lats[j].write <= remote_latency) {
             exit_with_message("The latency specified for the emulation was less than the actual latency.\n");
         }
     }
 
+    if (remote_latency > 0) {
+        if (nmem != 1 || nphys > 0) {
+            exit_with_message("Failed to execute. Give a pair of latencies for the remote node with -N, without -P.\n");
+        }
+        /* the remote node is told apart by in-core counters, not by PEBS */
+        incore_enable_remote();
+    }
+    if (model_load_enabled()) {
+        /* the load of the memory is counted by in-core counters */
+        incore_enable_load();
+    }
+    if (nphys > 0 && nphys != nmem) {
+        exit_with_message("Failed to execute. Give the latencies of each physical range of -P.\n");
+    }
+    if (nbw > nmem) {
+        exit_with_message("Failed to execute. More bandwidth ceilings of -B than the memory regions.\n");
+    }
+    if (use_rdpmc && nworkers == 0) {
+        /* only a worker pinned to a CPU core reads its counters with rdpmc */
+        fprintf(stderr, "Warning: -r has no effect without -j. The counters are read with read().\n");
+    }
+    if (media_enabled() && (pebs_sample_period != 1 || pebs_adaptive)) {
+        /* only the sampled misses are fed to the media buffer */
+        exit_with_message("Failed to execute. The media buffer of -x needs every miss sampled: -p 1 without -A.\n");
+    }
+    /* the regions without -B are not limited */
+    struct emul_nvm_bandwidth *emul_nvm_bws = NULL;
+    if (nbw > 0) {
+        emul_nvm_bws = (struct emul_nvm_bandwidth *)calloc(sizeof(struct emul_nvm_bandwidth), nmem);
+        if (emul_nvm_bws == NULL) {
+            handle_error("calloc");
+        }
+        for (j = 0; j < nbw; j++) {
+            emul_nvm_bws[j] = bw_limits[j];
+            DEBUG_PRINT("nvm%d: bandwidth read:%lf, write:%lf\n", j, emul_nvm_bws[j].read, emul_nvm_bws[j].write);
+        }
+    }
+    /*
+     * With -P, the monitored threads are emulated by the physical addresses
+     * of their samples. The threads not monitored are not sampled.
+     */
+    set_phys_regions_mon(nphys, phys_ranges);
+    if (nphys > 0) {
+        fprintf(stderr, "Warning: -P emulates the ranges only for the target of -t and the threads registered "
+                "to the emulator. The other threads and processes accessing the ranges are not emulated.\n");
+    }
+    bool hybrid = (nmem >= 2 || nphys > 0);
+    /* the latency model of the monitors, see select_model() */
+    const struct __model *model = &single_model;
+    if (remote_latency > 0) {
+        model = &numa_model;
+    } else if (nphys > 0) {
+        model = &hybrid_model;
+    }
+
     /* check of the limitation */
-    if (tnum > ncpu) {
+    if (!multiplex && tnum > ncpu) {
         exit_with_message("Failed to execute. The number of processes/threads of the target application is more than physical CPU cores.\n");
     }
 
@@ -210,7 +447,28 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    initMon(tnum, &use_cpuset, &mons, nmem);
+    if (heatmap_path != NULL && init_heatmap(heatmap_path, heatmap_shift) < 0) {
+        exit_with_message("Failed to create the heatmap file\n");
+    }
+    if (pebs_drain && pebs_start_drain() < 0) {
+        exit_with_message("Failed to create the PEBS drain thread\n");
+    }
+    initMon(tnum, &use_cpuset, &mons, nmem, multiplex);
+    if (pebs_percpu && hybrid) {
+        if (pebs_start_percpu(&use_cpuset, pebs_sample_period, lookup_mon_pebs) < 0) {
+            exit_with_message("Failed to create the per-CPU PEBS buffers\n");
+        }
+    }
+
+    /* get CPU information */
+    if (!get_cpu_info(&mons[0].before->cpuinfo)) {
+        exit_with_message("Failed to obtain CPU information.\n");
+    }
+
+    /* check the CPU model */
+    if (detect_model(mons[0].before->cpuinfo.cpu_model)) {
+        exit_with_message("Failed to execute. This CPU model is not supported. Update src/types.c\n");
+    }
 
     if (target_path != NULL) {
         /* zombie avoid */
@@ -228,12 +486,14 @@ int main(int argc, char **argv)
         }
 
         // In case of process, use SIGSTOP.
-        i = enable_mon(t_process, t_process, true, 0, tnum, mons);
+        i = enable_mon(t_process, t_process, true, nphys > 0 ? pebs_sample_period : 0, tnum, mons);
         if (i == -1) {
             exit_with_message("Failed to enable monitor\n");
         } else if (i < 0) {
             // pid not found. might be already terminated.
             DEBUG_PRINT("pid(%ul) not found. might be already terminated.", t_process);
+        } else {
+            activate_mon(i, mons, model, NULL);
         }
         cur_processes++;
         DEBUG_PRINT("pid of mes = %d, cur process=%d\n", t_process, cur_processes);
@@ -241,25 +501,24 @@ int main(int argc, char **argv)
         oneshot = false;
     }
 
-    if (cur_processes >= ncpu) {
+    if (!multiplex && cur_processes >= ncpu) {
         exit_with_message("Failed to execute. The number of processes/threads of the target application is more than physical CPU cores.\n");
     }
 
     // Wait all the target processes until emulation process initialized.
     stop_all_mons(cur_processes, mons);
 
-    /* get CPU information */
-    if (!get_cpu_info(&mons[0].before->cpuinfo)) {
-        exit_with_message("Failed to obtain CPU information.\n");
-    }
-
-    /* check the CPU model */
-    if (detect_model(mons[0].before->cpuinfo.cpu_model)) {
-        exit_with_message("Failed to execute. This CPU model is not supported. Update src/types.c\n");
-    }
-
+    pmu.rdpmc = use_rdpmc;
+    pmu.uring = use_uring;
+    pmu.nimc = 0;
+    pmu.imcs = NULL;
+    pmu.cpu_part = NULL;
     init_all_pmcs(&pmu, t_process);
     init_all_cbos(&pmu);
+    if (emul_nvm_bws != NULL && init_all_imcs(&pmu) < 0) {
+        exit_with_message("Failed to open the IMC counters for the bandwidth ceilings of -B\n");
+    }
+    init_snapshot(&snap);
 
     /* Caculate epoch time */
     struct timespec waittime;
@@ -272,51 +531,73 @@ int main(int argc, char **argv)
     printf("set nano sec = %lu\n", waittime.tv_nsec);
 
     /* read CBo params */
+    read_snapshot(&pmu, &snap);
     for (i = 0; i < cur_processes; i++) {
         mon = &mons[i];
-        for (j = 0; j < ncbo; j++) {
-            read_cbo_elems(&pmu.cbos[j], &mon->before->cbos[j]);
+        read_mon_elem(mon, &snap, mon->before);
+    }
+
+    struct __emul emul = {
+        .ncpu = ncpu,
+        .ncbo = ncbo,
+        .tnum = tnum,
+        .mons = mons,
+        .pmu = &pmu,
+        .snap = &snap,
+        .cpu_freq = cpu_freq,
+        .weight = weight,
+        .dram_latency = dram_latency,
+        .remote_latency = remote_latency,
+        .emul_nvm_lats = emul_nvm_lats,
+        .emul_nvm_bws = emul_nvm_bws,
+        .waittime = waittime,
+    };
+    if (trace_path != NULL && init_trace(trace_path, &emul) < 0) {
+        exit_with_message("Failed to create the trace file\n");
+    }
+    struct __resume_sched sched;
+    if (use_deadline) {
+        if (init_resume_sched(&sched, mons, tnum) < 0) {
+            exit_with_message("Failed to create the resume scheduler\n");
+        }
+        emul.sched = &sched;
+    }
+    struct __epoch epoch;
+    struct __workers workers;
+    struct __uring ring;
+    struct __uring *ringp = NULL;
+    if (nworkers > 0) {
+        if (init_workers(&workers, nworkers, &emul, &use_cpuset) < 0) {
+            exit_with_message("Failed to create emulator workers\n");
         }
-        for (j = 0; j < ncpu; j++) {
-            read_cpu_elems(&pmu.cpus[j], &mon->before->cpus[j]);
+    } else if (use_uring) {
+        if (init_snapshot_uring(&ring, 1) < 0) {
+            fprintf(stderr, "io_uring is not available, fall back to read().\n");
+        } else {
+            ringp = &ring;
         }
     }
 
-    uint32_t diff_nsec = 0;
-    struct timespec start_ts, end_ts;
+    uint64_t diff_nsec = 0;
     struct timespec sleep_start_ts, sleep_end_ts;
-#ifdef VERBOSE_DEBUG
-    struct timespec recv_ts;
-#endif
+    struct __epoch_timer timer;
+    if (init_epoch_timer(&timer, &waittime) < 0) {
+        exit_with_message("Failed to create the epoch timer\n");
+    }
+    timer.sched = emul.sched;
     // Wait all the target processes until emulation process initialized.
     run_all_mons(cur_processes, mons);
     for (i = 0; i < cur_processes; i++) {
         clock_gettime(CLOCK_MONOTONIC, &mons[i].start_exec_ts);
     }
+    clock_gettime(CLOCK_MONOTONIC, &epoch.end_ts);
 
-    /*
-     * The format for receiving an tgid,tid,opcode via a socket is as follows.
-     *   |  tgid:32bit  |  tid:32bit  |  opcode:32bit  |  num_of_region:32bit  |
-     * To emulate the hybrid memory, specify 2 or more for num_of_region.
-     * When specifying 1 or more in num_of_region, add the following format to
-     * as repeatedly as the num_of_region in addition to the above.
-     *   |  address:64bit  |  size:64bit  |
-     */
-    enum opcode {
-        MES_PROCESS_CREATE = 0,
-        MES_THREAD_CREATE = 1,
-        MES_THREAD_EXIT = 2,
-    };
-    struct op_data {
-        uint32_t tgid;
-        uint32_t tid;
-        uint32_t opcode;
-        uint32_t num_of_region;
-    };
-    size_t regs_size = sizeof(struct __region_info) * nmem;
-    size_t sock_data_size = sizeof(struct  op_data) + regs_size;
-    size_t sock_buf_size = sock_data_size + 1/*for size check*/;
-    char *sock_buf = (char *)malloc(sock_buf_size);
+    struct __control control;
+    if (init_control(&control, sock, tnum, mons, &pmu, nmem, remote_latency > 0 ? 0 : pebs_sample_period) < 0) {
+        exit_with_message("Failed to create the control thread\n");
+    }
+    struct __ctl_msg msg;
+    struct timespec heatmap_ts = epoch.end_ts;
 
     while(1) {
         /* wait for pre-defined interval */
@@ -325,99 +606,9 @@ int main(int argc, char **argv)
 #ifdef VERBOSE_DEBUG
         DEBUG_PRINT("sleep_start_ts: %010lu.%09lu\n", sleep_start_ts.tv_sec, sleep_start_ts.tv_nsec);
 #endif
-        int n;
-        do {
-            memset(sock_buf, 0, sock_buf_size);
-            // without blocking
-            n = recv(sock, sock_buf, sock_buf_size, MSG_DONTWAIT);
-            if (n < 1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    // no data
-                    break;
-                } else {
-                    handle_error("Failed to recv");
-                }
-            } else if (n >= sizeof(struct op_data) && n <= sock_data_size) {
-                struct op_data *opd = (struct op_data *)sock_buf;
-                DEBUG_PRINT("received data: size=%d, tgid=%u, tid=%u, opcode=%u, num_of_region=%u\n",
-                            n, opd->tgid, opd->tid, opd->opcode, opd->num_of_region);
-
-                if (opd->opcode == MES_THREAD_CREATE || opd->opcode == MES_PROCESS_CREATE) {
-                    int target;
-                    bool is_process = (opd->opcode == MES_PROCESS_CREATE) ? true : false;
-                    uint64_t period = (opd->num_of_region >= 2) ? pebs_sample_period : 0 ; // is hybrid
-                    // register to monitor
-                    target = enable_mon(opd->tgid, opd->tid, is_process, period, tnum, mons);
-                    if (target == -1) {
-                        exit_with_message("Failed to enable monitor\n");
-                    } else if (target < 0) {
-                        // tid not found. might be already terminated.
-                        continue;
-                    }
-                    mon = &mons[target];
-                    if (opd->num_of_region >= 2) { // Ignored if num_of_region is 1 or less
-                        // pebs sampling
-                        if ((n - sizeof(struct op_data)) != (sizeof(struct __region_info) * opd->num_of_region)) {
-                            exit_with_message("Received data is invalid.\n");
-                        }
-                        struct __region_info *ri = (struct __region_info *)(sock_buf + sizeof(struct op_data));
-                        if (set_region_info_mon(mon, opd->num_of_region, ri) < 0) {
-                            exit_with_message("Received data is invalid.\n");
-                        }
-                    }
-                    // Wait the target processes until emulation process initialized.
-                    stop_mon(mon);
-                    /* read CBo params */
-                    for (j = 0; j < ncbo; j++) {
-                        read_cbo_elems(&pmu.cbos[j], &mon->before->cbos[j]);
-                    }
-                    for (j = 0; j < ncpu; j++) {
-                        read_cpu_elems(&pmu.cpus[j], &mon->before->cpus[j]);
-                    }
-                    // Run the target processes.
-                    run_mon(mon);
-                    clock_gettime(CLOCK_MONOTONIC, &mon->start_exec_ts);
-                } else if (opd->opcode == MES_THREAD_EXIT) {
-                    // unregister from monitor, and display results.
-                    if (terminate_mon(opd->tgid, opd->tid, tnum, mons) < 0) {
-                        DEBUG_PRINT("It might be already terminated.\n");
-                    }
-                }
-            } else {
-                exit_with_message("received data is invalid size: size=%d\n", n);
-            }
-        } while (n > 0); // check the next message.
 
-#ifdef VERBOSE_DEBUG
-        clock_gettime(CLOCK_MONOTONIC, &recv_ts);
-        DEBUG_PRINT("recv_ts       : %010lu.%09lu\n", recv_ts.tv_sec, recv_ts.tv_nsec);
-        if (recv_ts.tv_nsec < sleep_start_ts.tv_nsec) {
-            DEBUG_PRINT("start - recv  : %10lu.%09lu\n", recv_ts.tv_sec - sleep_start_ts.tv_sec - 1, \
-                        recv_ts.tv_nsec + 1000000000 - sleep_start_ts.tv_nsec);
-        } else {
-            DEBUG_PRINT("start - recv  : %10lu.%09lu\n", recv_ts.tv_sec - sleep_start_ts.tv_sec, \
-                        recv_ts.tv_nsec - sleep_start_ts.tv_nsec);
-        }
-#endif
-
-        struct timespec req = waittime;
-        struct timespec rem = {0};
-        while (1) {
-            ret = nanosleep(&req, &rem);
-            if (ret == 0) { // success
-                break;
-            } else { // ret < 0
-                if (errno == EINTR) {
-                    // The pause has been interrupted by a signal that was delivered to the thread.
-                    DEBUG_PRINT("nanosleep: remain time %ld.%09ld(sec)\n", (long)rem.tv_sec, (long)rem.tv_nsec);
-                    req = rem; // call nanosleep() again with the remain time.
-                } else {
-                    // fatal error
-                    handle_error("Failed to wait nanotime");
-                }
-            }
-        }
-        clock_gettime(CLOCK_MONOTONIC, &sleep_end_ts);
+        /* wait for the deadline of the epoch, regardless of the time spent above */
+        wait_epoch_timer(&timer, &sleep_end_ts);
 
 #ifdef VERBOSE_DEBUG
         DEBUG_PRINT("sleep_end_ts  : %010lu.%09lu\n", sleep_end_ts.tv_sec, sleep_end_ts.tv_nsec);
@@ -430,196 +621,32 @@ int main(int argc, char **argv)
         }
 #endif
 
-        for (i = 0; i < tnum; i++) {
-            mon = &mons[i];
-            if (mon->status == MONITOR_DISABLE) {
-                continue;
-            }
-            if (mon->status == MONITOR_ON) {
-                clock_gettime(CLOCK_MONOTONIC, &start_ts);
-                DEBUG_PRINT("[%d:%u:%u] start_ts: %010lu.%09lu\n", i, mon->tgid, mon->tid, start_ts.tv_sec, start_ts.tv_nsec);
-
-#ifndef ONLY_CALCULATION
-                /*stop target process group: send SIGSTOP */
-                stop_mon(mon);
-#endif
-                /* read CBo values */
-                uint64_t wb_cnt = 0;
-                for (j = 0; j < ncbo; j++) {
-                    read_cbo_elems(&pmu.cbos[j], &mon->after->cbos[j]);
-                    wb_cnt += mon->after->cbos[j].llc_wb - mon->before->cbos[j].llc_wb;
-                }
-                DEBUG_PRINT("[%d:%u:%u] LLC_WB = %" PRIu64 "\n", i, mon->tgid, mon->tid, wb_cnt);
-
-                /* read CPU params */
-                uint64_t cpus_dram_rds=0;
-                uint64_t target_l2stall=0, target_llcmiss=0, target_llchits=0;
-                for (j = 0; j < ncpu; ++j) {
-                    read_cpu_elems(&pmu.cpus[j], &mon->after->cpus[j]);
-                    cpus_dram_rds += mon->after->cpus[j].all_dram_rds - mon->before->cpus[j].all_dram_rds;
-                }
-
-                if (mon->num_of_region >= 2) {
-                    /* read PEBS sample */
-                    if (pebs_read(&mon->pebs_ctx, mon->num_of_region, mon->region_info, &mon->after->pebs) < 0) {
-                        fprintf(stderr, "[%d:%u:%u] Warning: Failed PEBS read\n", i, mon->tgid, mon->tid);
-                    }
-                    target_llcmiss = mon->after->pebs.llcmiss - mon->before->pebs.llcmiss;
-                } else {
-                    target_llcmiss = mon->after->cpus[mon->cpu_core].cpu_llcl_miss - mon->before->cpus[mon->cpu_core].cpu_llcl_miss;
-                }
-
-                target_l2stall = mon->after->cpus[mon->cpu_core].cpu_l2stall_t - mon->before->cpus[mon->cpu_core].cpu_l2stall_t;
-                target_llchits = mon->after->cpus[mon->cpu_core].cpu_llcl_hits - mon->before->cpus[mon->cpu_core].cpu_llcl_hits;
-
-                if (cpus_dram_rds < target_llcmiss) {
-                    DEBUG_PRINT("[%d:%u:%u]warning: target_llcmiss is more than cpus_dram_rds. target_llcmiss %ju, cpus_dram_rds %ju\n",
-                                i, mon->tgid, mon->tid, target_llcmiss, cpus_dram_rds);
-                }
-                uint64_t llcmiss_wb = 0;
-                // To estimate the number of the writeback-involving LLC
-                // misses of the CPU core (llcmiss_wb), the total number of
-                // writebacks observed in L3 (wb_cnt) is devided
-                // proportionally, according to the number of the ratio of
-                // the LLC misses of the CPU core (target_llcmiss) to that
-                // of the LLC misses of all the CPU cores and the
-                // prefetchers (cpus_dram_rds).
-                if (wb_cnt <= cpus_dram_rds && target_llcmiss <= cpus_dram_rds && cpus_dram_rds > 0) {
-                    // Equation (9) in the IEICE paper
-                    llcmiss_wb = wb_cnt * ((double) target_llcmiss / cpus_dram_rds);
-                } else {
-                    fprintf(stderr, "[%d:%u:%u]warning: wb_cnt %ju, target_llcmiss %ju, cpus_dram_rds %ju\n",
-                            i, mon->tgid, mon->tid, wb_cnt, target_llcmiss, cpus_dram_rds);
-                    llcmiss_wb = target_llcmiss;
-                }
-
-                uint64_t llcmiss_ro = 0;
-                if(target_llcmiss < llcmiss_wb) {
-                    DEBUG_PRINT("[%d:%u:%u] cpus_dram_rds %lu, llcmiss_wb %lu, target_llcmiss %lu\n",
-                                i, mon->tgid, mon->tid, cpus_dram_rds, llcmiss_wb, target_llcmiss);
-                    printf("!!!!llcmiss_ro is %lu!!!!!\n", llcmiss_ro);
-                    llcmiss_wb = target_llcmiss;
-                    llcmiss_ro = 0;
-                } else {
-                    llcmiss_ro = target_llcmiss - llcmiss_wb;
-                }
-                DEBUG_PRINT("[%d:%u:%u]llcmiss_wb=%lu, llcmiss_ro=%lu\n", i, mon->tgid, mon->tid ,llcmiss_wb, llcmiss_ro);
-
-                uint64_t mastall_wb = 0;
-                uint64_t mastall_ro = 0;
-                // If both target_llchits and target_llcmiss are 0, it means that hit in L2.
-                // Stall by LLC misses is 0.
-                if (target_llchits || target_llcmiss) {
-                    mastall_wb = (double)(target_l2stall / cpu_freq) * ( (double)(weight * llcmiss_wb) / (double)(target_llchits + (weight * target_llcmiss)) ) * 1000;
-                    mastall_ro = (double)(target_l2stall / cpu_freq) * ( (double)(weight * llcmiss_ro) / (double)(target_llchits + (weight * target_llcmiss)) ) * 1000;
-                }
-                DEBUG_PRINT("l2stall=%" PRIu64 ", mastall_wb=%" PRIu64 ", mastall_ro=%" PRIu64 ", target_llchits=%" PRIu64 ", target_llcmiss=%" PRIu64 ", weight=%lf\n", \
-                        target_l2stall, mastall_wb, mastall_ro, target_llchits, target_llcmiss, weight);
-
-                uint64_t ma_wb = (double)mastall_wb / dram_latency;
-                uint64_t ma_ro = (double)mastall_ro / dram_latency;
-
-                uint64_t emul_delay = 0;
-                if (mon->num_of_region < 2) {
-                    emul_delay = (double)(ma_ro) * (emul_nvm_lats[0].read - dram_latency) + (double)(ma_wb) * (emul_nvm_lats[0].write - dram_latency);
-                } else { // Emulate Hybrid Memory
-                    bool total_is_zero = (mon->after->pebs.total - mon->before->pebs.total) ? false : true;
-                    double sample = 0;
-                    double sample_prop = 0;
-                    double sample_total = (double)(mon->after->pebs.total - mon->before->pebs.total);
-                    if (total_is_zero) {
-                        // If the total is 0, divide equally.
-                        sample_prop = (double)1 / (double)mon->num_of_region;
-                    }
-                    DEBUG_PRINT("[%d:%u:%u] pebs: total=%lu, \n", i, mon->tgid, mon->tid, mon->after->pebs.total);
-                    for (j = 0; j < mon->num_of_region; j++) {
-                        if (!total_is_zero) {
-                            sample = (double)(mon->after->pebs.sample[j] - mon->before->pebs.sample[j]);
-                            sample_prop = sample / sample_total;
-                        }
-                        emul_delay += (double)(ma_ro) * sample_prop * (emul_nvm_lats[j].read - dram_latency) +
-                                      (double)(ma_wb) * sample_prop * (emul_nvm_lats[j].write - dram_latency);
-                        mon->before->pebs.sample[j] = mon->after->pebs.sample[j];
-                        DEBUG_PRINT("[%d:%u:%u] pebs sample[%d]: =%lu, \n", i, mon->tgid, mon->tid, j, mon->after->pebs.sample[j]);
-                    }
-                    mon->before->pebs.total = mon->after->pebs.total;
-                }
-
-                DEBUG_PRINT("ma_wb=%" PRIu64 ", ma_ro=%" PRIu64 ", delay=%" PRIu64 "\n", ma_wb, ma_ro, emul_delay);
-
-                /* compensation of delay END(1) */
-                clock_gettime(CLOCK_MONOTONIC, &end_ts);
-                diff_nsec += (end_ts.tv_sec - start_ts.tv_sec)*1000000000 +
-                             (end_ts.tv_nsec - start_ts.tv_nsec );
-                DEBUG_PRINT("dif:%'12u\n", diff_nsec);
-
-                uint64_t calibrated_delay = (diff_nsec > emul_delay) ? 0: emul_delay - diff_nsec;
-                // uint64_t calibrated_delay = emul_delay;
-                mon->total_delay += (double)calibrated_delay / 1000000000;
-                diff_nsec = 0;
-
-#ifndef ONLY_CALCULATION
-                /* insert emulated NVM latency */
-                mon->injected_delay.tv_sec  += (calibrated_delay / 1000000000);
-                mon->injected_delay.tv_nsec += (calibrated_delay % 1000000000);
-                DEBUG_PRINT("[%d:%u:%u]delay:%'10lu , total delay:%'lf\n", i, mon->tgid, mon->tid, calibrated_delay, mon->total_delay);
-#endif
-                swap        = mon->before;
-                mon->before = mon->after;
-                mon->after  = swap;
-
-#ifndef ONLY_CALCULATION
-                /* continue suspended processes: send SIGCONT */
-                // unfreeze_counters_cbo_all(fds.msr[0]);
-                // start_pmc(&fds, i);
-                if (calibrated_delay == 0) {
-                    clear_mon_time(&mon->wasted_delay);
-                    clear_mon_time(&mon->injected_delay);
-                    run_mon(mon);
-                }
-#endif
-
-            } else if (mon->status == MONITOR_OFF) {
-                // Wasted epoch time
-                clock_gettime(CLOCK_MONOTONIC, &start_ts);
-                uint64_t sleep_diff = (sleep_end_ts.tv_sec - sleep_start_ts.tv_sec)*1000000000 + \
-                (sleep_end_ts.tv_nsec - sleep_start_ts.tv_nsec );
-                struct timespec sleep_time;
-                sleep_time.tv_sec = sleep_diff / 1000000000;
-                sleep_time.tv_nsec = sleep_diff % 1000000000;
-                mon->wasted_delay.tv_sec += sleep_time.tv_sec;
-                mon->wasted_delay.tv_nsec += sleep_time.tv_nsec;
-                DEBUG_PRINT("[%d:%u:%u][OFF] total: %'lu | wasted : %'lu | waittime : %'lu | squabble : %'lu\n", \
-                            i, mon->tgid, mon->tid, mon->injected_delay.tv_nsec, mon->wasted_delay.tv_nsec, waittime.tv_nsec, mon->squabble_delay.tv_nsec);
-                if(check_continue_mon(i, mons, sleep_time)) {
-                    clear_mon_time(&mon->wasted_delay);
-                    clear_mon_time(&mon->injected_delay);
-                    run_mon(mon);
+        /* hand over the monitors registered by the control thread */
+        while (pop_control(&control, &msg)) {
+            if (msg.opcode == MES_THREAD_CREATE) {
+                activate_mon(msg.target, mons, model, &snap);
+            } else if (msg.opcode == MES_THREAD_EXIT) {
+                // unregister from monitor, and display results.
+                if (terminate_mon(msg.tgid, msg.tid, tnum, mons) < 0) {
+                    DEBUG_PRINT("It might be already terminated.\n");
                 }
-                clock_gettime(CLOCK_MONOTONIC, &end_ts);
-                diff_nsec += (end_ts.tv_sec - start_ts.tv_sec)*1000000000 + \
-                (end_ts.tv_nsec - start_ts.tv_nsec );
             }
+        }
 
-            if(mon->status == MONITOR_OFF && mon->injected_delay.tv_nsec != 0) {
-                long remain_time = mon->injected_delay.tv_nsec - mon->wasted_delay.tv_nsec;
-                /* do we need to get squabble time ? */
-                if (mon->wasted_delay.tv_sec >= waittime.tv_sec && \
-                    remain_time < waittime.tv_nsec) {
-                        mon->squabble_delay.tv_nsec += remain_time;
-                        if (mon->squabble_delay.tv_nsec < 40000000) {
-                            DEBUG_PRINT("[SQ]total: %'lu | wasted : %'lu | waittime : %'lu | squabble : %'lu\n", \
-                                        mon->injected_delay.tv_nsec, mon->wasted_delay.tv_nsec, waittime.tv_nsec, mon->squabble_delay.tv_nsec);
-                            clear_mon_time(&mon->wasted_delay);
-                            clear_mon_time(&mon->injected_delay);
-                            run_mon(mon);
-                        } else {
-                            mon->injected_delay.tv_nsec += mon->squabble_delay.tv_nsec;
-                            clear_mon_time(&mon->squabble_delay);
-                        }
-                }
+        epoch.start_ts = epoch.end_ts;
+        epoch.end_ts = sleep_end_ts;
+        if (nworkers > 0) {
+            run_workers(&workers, &epoch);
+        } else {
+            emul_epoch(&emul, &epoch, &diff_nsec, ringp);
+        }
+        if (heatmap_enabled() && sleep_end_ts.tv_sec - heatmap_ts.tv_sec >= HEATMAP_INTERVAL_SEC) {
+            /* the page counts of the last interval */
+            heatmap_ts = sleep_end_ts;
+            if (dump_heatmap(&heatmap_ts) < 0) {
+                fprintf(stderr, "Warning: Failed to dump the heatmap\n");
             }
-        } // End for-loop for all target processes
+        }
         if (check_all_mons_terminated(tnum, mons)) {
 #ifdef VERBOSE_DEBUG
             DEBUG_PRINT("All processes have already been terminated.\n");
@@ -630,12 +657,35 @@ int main(int argc, char **argv)
         }
     } // End while-loop for emulation
 
+    printf("epochs=%lu, overruns=%lu\n", timer.epochs, timer.overruns);
+    if (use_deadline) {
+        printf("resumed=%lu, average late=%lu nsec, max late=%lu nsec\n", sched.resumed,
+               sched.resumed ? sched.total_late / sched.resumed : 0, sched.max_late);
+        fini_resume_sched(&sched);
+    }
+
     /* cleanup */
+    fini_control(&control);
+    pebs_stop_drain();
+    if (pebs_percpu && hybrid) {
+        pebs_stop_percpu();
+    }
+    fini_heatmap();
+    fini_trace();
+    fini_epoch_timer(&timer);
+    if (nworkers > 0) {
+        fini_workers(&workers);
+    }
+    if (ringp != NULL) {
+        fini_uring(ringp);
+    }
     fini_all_pmcs(&pmu);
     fini_all_cbos(&pmu);
+    fini_all_imcs(&pmu);
+    fini_snapshot(&snap);
     freeMon(tnum, &mons);
-    free(sock_buf);
     free(emul_nvm_lats);
+    free(emul_nvm_bws);
 
     close(sock);
 
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+#include <stdio.h>
+#include <stdlib.h>
+#include "media.h"
+#include "common.h"
+
+/* the number of the lines of a buffer, 0 if the media is not modeled */
+static int media_lines = 0;
+
+int media_set_lines(const int n)
+{
+    if (n <= 0) {
+        return -1;
+    }
+    media_lines = n;
+    return 0;
+}
+
+bool media_enabled(void)
+{
+    return media_lines > 0;
+}
+
+/* Allocate the buffer of a thread. It is called after media_set_lines(). */
+int init_media_buffer(struct __media_buffer *buf)
+{
+    buf->n = media_lines;
+    buf->next = 0;
+    buf->lines = NULL;
+    buf->slots = NULL;
+    if (buf->n == 0) {
+        return 0;
+    }
+    /* at most a half of the slots is used */
+    for (buf->bits = 1; (1 << buf->bits) < 2 * buf->n; buf->bits++) {
+    }
+    buf->lines = (uint64_t *)malloc(sizeof(uint64_t) * buf->n);
+    buf->slots = (uint64_t *)malloc(sizeof(uint64_t) << buf->bits);
+    if (buf->lines == NULL || buf->slots == NULL) {
+        handle_error("malloc");
+    }
+    reset_media_buffer(buf);
+    return 0;
+}
+
+void reset_media_buffer(struct __media_buffer *buf)
+{
+    int i;
+
+    for (i = 0; i < buf->n; i++) {
+        buf->lines[i] = UINT64_MAX;
+    }
+    if (buf->slots != NULL) {
+        for (i = 0; i < (1 << buf->bits); i++) {
+            buf->slots[i] = UINT64_MAX;
+        }
+    }
+    buf->next = 0;
+}
+
+void fini_media_buffer(struct __media_buffer *buf)
+{
+    free(buf->lines);
+    free(buf->slots);
+    buf->lines = NULL;
+    buf->slots = NULL;
+    buf->n = 0;
+}
+
+/* The home slot of a line: Fibonacci hashing, as the lines are sequential. */
+static inline int media_hash(const struct __media_buffer *buf, const uint64_t line)
+{
+    return (int)((line * 0x9e3779b97f4a7c15ULL) >> (64 - buf->bits));
+}
+
+/* The slot of the line, or -1 if the line is not in the buffer. */
+static int media_find(const struct __media_buffer *buf, const uint64_t line)
+{
+    const int mask = (1 << buf->bits) - 1;
+    int i;
+
+    for (i = media_hash(buf, line); buf->slots[i] != UINT64_MAX; i = (i + 1) & mask) {
+        if (buf->slots[i] == line) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void media_insert(struct __media_buffer *buf, const uint64_t line)
+{
+    const int mask = (1 << buf->bits) - 1;
+    int i;
+
+    for (i = media_hash(buf, line); buf->slots[i] != UINT64_MAX; i = (i + 1) & mask) {
+    }
+    buf->slots[i] = line;
+}
+
+/*
+ * Remove the line of the i-th slot. The following lines of the probe
+ * sequence are shifted back, so that no tombstone is left.
+ */
+static void media_remove(struct __media_buffer *buf, int i)
+{
+    const int mask = (1 << buf->bits) - 1;
+    int j, home;
+
+    for (j = (i + 1) & mask; buf->slots[j] != UINT64_MAX; j = (j + 1) & mask) {
+        home = media_hash(buf, buf->slots[j]);
+        /* the line at j stays if its home is cyclically in (i, j] */
+        if ((i < j) ? (i < home && home <= j) : (i < home || home <= j)) {
+            continue;
+        }
+        buf->slots[i] = buf->slots[j];
+        i = j;
+    }
+    buf->slots[i] = UINT64_MAX;
+}
+
+/*
+ * Access the media line of addr. Return true if the line is in the buffer,
+ * i.e., the access is combined with a former one and does not reach the
+ * media. Otherwise the line replaces the oldest one.
+ */
+bool media_access(struct __media_buffer *buf, const uint64_t addr)
+{
+    uint64_t line = addr >> MEDIA_LINE_SHIFT;
+    int i;
+
+    if (buf->n == 0) {
+        return false;
+    }
+    if (media_find(buf, line) >= 0) {
+        return true;
+    }
+    if (buf->lines[buf->next] != UINT64_MAX) {
+        i = media_find(buf, buf->lines[buf->next]);
+        if (i >= 0) {
+            media_remove(buf, i);
+        }
+    }
+    buf->lines[buf->next] = line;
+    media_insert(buf, line);
+    buf->next = (buf->next + 1) % buf->n;
+    return false;
+}
+
+/*
+ * The ratio of the accesses reaching the media, given the buffer hits and
+ * the samples of an epoch. Without samples, all the accesses are assumed
+ * to reach the media.
+ */
+double media_miss_ratio(const uint64_t hits, const uint64_t samples)
+{
+    if (samples == 0 || hits > samples) {
+        return 1;
+    }
+    return 1 - (double)hits / samples;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#ifndef __MEDIA_H
+#define __MEDIA_H
+#include <stdint.h>
+#include <stdbool.h>
+
+/* The internal access unit of the NVM media, e.g., 256 B of Optane DC PMM. */
+#define MEDIA_LINE_SHIFT 8
+
+/*
+ * The on-DIMM buffer combining the accesses to a media line, replaced in
+ * FIFO order. It is fed with the addresses of the PEBS load samples of a
+ * thread. The lines in the buffer are also kept in an open-addressing hash
+ * set, so that a sample is looked up without scanning the buffer.
+ */
+struct __media_buffer {
+    int n;                  /* the number of the lines, 0 if not modeled */
+    int next;               /* the line replaced at the next miss */
+    uint64_t *lines;        /* address >> MEDIA_LINE_SHIFT, or UINT64_MAX */
+    int bits;               /* the hash set has 1 << bits slots */
+    uint64_t *slots;        /* the lines in the buffer, or UINT64_MAX */
+};
+
+int media_set_lines(const int);
+bool media_enabled(void);
+int init_media_buffer(struct __media_buffer *);
+void reset_media_buffer(struct __media_buffer *);
+void fini_media_buffer(struct __media_buffer *);
+bool media_access(struct __media_buffer *, const uint64_t);
+double media_miss_ratio(const uint64_t, const uint64_t);
+#endif
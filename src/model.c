@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "common.h"
+#include "model.h"
+#include "emul.h"
+#include "pebs.h"
+#include "media.h"
+
+/*
+ * The load curve: the emulated latencies are scaled by the factor at the
+ * load of the memory, i.e., the mean number of the outstanding offcore data
+ * reads of the core while it has any. The factor is interpolated linearly
+ * between the points, from 1 at no load, and is flat beyond the last point.
+ */
+struct __load_point {
+    double occupancy;
+    double factor;
+};
+
+static struct __load_point load_curve[MODEL_MAX_LOAD_POINTS];
+static int nload_points = 0;
+
+/* Add a point of the load curve. The points are given in ascending order. */
+int model_add_load_point(const double occupancy, const double factor)
+{
+    if (nload_points == MODEL_MAX_LOAD_POINTS || occupancy <= 0 || factor < 1) {
+        return -1;
+    }
+    if (nload_points > 0 && occupancy <= load_curve[nload_points - 1].occupancy) {
+        return -1;
+    }
+    load_curve[nload_points].occupancy = occupancy;
+    load_curve[nload_points].factor = factor;
+    nload_points++;
+    return 0;
+}
+
+bool model_load_enabled(void)
+{
+    return nload_points > 0;
+}
+
+static double load_factor(const int i, const struct __monitor *mon, const struct __model_input *in)
+{
+    double occupancy, x0 = 0, y0 = 1;
+    int j;
+
+    if (nload_points == 0 || in->offcore_cyc == 0) {
+        return 1;
+    }
+    occupancy = (double)in->offcore_occ / in->offcore_cyc;
+    for (j = 0; j < nload_points; j++) {
+        if (occupancy <= load_curve[j].occupancy) {
+            break;
+        }
+        x0 = load_curve[j].occupancy;
+        y0 = load_curve[j].factor;
+    }
+    double factor = y0;
+    if (j < nload_points) {
+        factor += (load_curve[j].factor - y0) * (occupancy - x0) / (load_curve[j].occupancy - x0);
+    }
+    DEBUG_PRINT("[%d:%u:%u] load: occupancy=%lf, factor=%lf\n", i, mon->tgid, mon->tid, occupancy, factor);
+    return factor;
+}
+
+void read_model_input(const struct __monitor *mon, const struct __epoch *ep, struct __model_input *in)
+{
+    in->wb_cnt        = mon->after->llc_wb - mon->before->llc_wb;
+    in->cpus_dram_rds = mon->after->all_dram_rds - mon->before->all_dram_rds;
+    in->l2stall       = mon->after->cpu.cpu_l2stall_t - mon->before->cpu.cpu_l2stall_t;
+    in->llchits       = mon->after->cpu.cpu_llcl_hits - mon->before->cpu.cpu_llcl_hits;
+    in->llcmiss       = mon->after->cpu.cpu_llcl_miss - mon->before->cpu.cpu_llcl_miss;
+    in->llcrmiss      = mon->after->cpu.cpu_llcr_miss - mon->before->cpu.cpu_llcr_miss;
+    in->imc_rd        = mon->after->imc_rd - mon->before->imc_rd;
+    in->imc_wr        = mon->after->imc_wr - mon->before->imc_wr;
+    in->epoch_nsec    = (ep->end_ts.tv_sec - ep->start_ts.tv_sec) * 1000000000 +
+                        (ep->end_ts.tv_nsec - ep->start_ts.tv_nsec);
+    in->offcore_occ   = mon->after->cpu.cpu_offcore_occ - mon->before->cpu.cpu_offcore_occ;
+    in->offcore_cyc   = mon->after->cpu.cpu_offcore_cyc - mon->before->cpu.cpu_offcore_cyc;
+}
+
+/*
+ * The delay of the j-th region when its traffic exceeds the bandwidth
+ * ceilings. The memory stalls stretch by the ratio of the traffic to the
+ * ceiling. The traffic of all the IMCs is divided among the regions in the
+ * proportions of the monitor, prop_ro and prop_wb.
+ */
+static double bw_delay(const struct __emul *emul, const struct __model_input *in, const int j,
+                       const double mastall_ro, const double mastall_wb,
+                       const double prop_ro, const double prop_wb)
+{
+    const struct emul_nvm_bandwidth *bw;
+    double ratio, delay = 0;
+
+    if (emul->emul_nvm_bws == NULL || in->epoch_nsec == 0) {
+        return 0;
+    }
+    bw = &emul->emul_nvm_bws[j];
+    /* GB/s is bytes per nsec */
+    if (bw->read > 0) {
+        ratio = (double)in->imc_rd * 64 * prop_ro / (bw->read * in->epoch_nsec);
+        if (ratio > 1) {
+            delay += mastall_ro * prop_ro * (ratio - 1);
+        }
+    }
+    if (bw->write > 0) {
+        ratio = (double)in->imc_wr * 64 * prop_wb / (bw->write * in->epoch_nsec);
+        if (ratio > 1) {
+            delay += mastall_wb * prop_wb * (ratio - 1);
+        }
+    }
+    return delay;
+}
+
+/* A region is bound by either its latencies or its bandwidth. */
+static inline double max_delay(const double lat_delay, const double bw_delay)
+{
+    return lat_delay > bw_delay ? lat_delay : bw_delay;
+}
+
+/*
+ * Estimate the stall time in nsec of the read-only and the
+ * writeback-involving LLC misses, given the LLC misses of the monitor.
+ */
+static void split_stalls(const struct __emul *emul, const int i, const struct __monitor *mon,
+                         const struct __model_input *in, const uint64_t target_llcmiss,
+                         double *mastall_ro, double *mastall_wb)
+{
+    const double cpu_freq = emul->cpu_freq;
+    const double weight = emul->weight;
+    const uint64_t wb_cnt = in->wb_cnt;
+    const uint64_t cpus_dram_rds = in->cpus_dram_rds;
+
+    DEBUG_PRINT("[%d:%u:%u] LLC_WB = %" PRIu64 "\n", i, mon->tgid, mon->tid, wb_cnt);
+    if (cpus_dram_rds < target_llcmiss) {
+        DEBUG_PRINT("[%d:%u:%u]warning: target_llcmiss is more than cpus_dram_rds. target_llcmiss %ju, cpus_dram_rds %ju\n",
+                    i, mon->tgid, mon->tid, target_llcmiss, cpus_dram_rds);
+    }
+    uint64_t llcmiss_wb = 0;
+    // To estimate the number of the writeback-involving LLC
+    // misses of the CPU core (llcmiss_wb), the total number of
+    // writebacks observed in L3 (wb_cnt) is devided
+    // proportionally, according to the number of the ratio of
+    // the LLC misses of the CPU core (target_llcmiss) to that
+    // of the LLC misses of all the CPU cores and the
+    // prefetchers (cpus_dram_rds).
+    if (wb_cnt <= cpus_dram_rds && target_llcmiss <= cpus_dram_rds && cpus_dram_rds > 0) {
+        // Equation (9) in the IEICE paper
+        llcmiss_wb = wb_cnt * ((double) target_llcmiss / cpus_dram_rds);
+    } else {
+        fprintf(stderr, "[%d:%u:%u]warning: wb_cnt %ju, target_llcmiss %ju, cpus_dram_rds %ju\n",
+                i, mon->tgid, mon->tid, wb_cnt, target_llcmiss, cpus_dram_rds);
+        llcmiss_wb = target_llcmiss;
+    }
+
+    uint64_t llcmiss_ro = 0;
+    if(target_llcmiss < llcmiss_wb) {
+        DEBUG_PRINT("[%d:%u:%u] cpus_dram_rds %lu, llcmiss_wb %lu, target_llcmiss %lu\n",
+                    i, mon->tgid, mon->tid, cpus_dram_rds, llcmiss_wb, target_llcmiss);
+        printf("!!!!llcmiss_ro is %lu!!!!!\n", llcmiss_ro);
+        llcmiss_wb = target_llcmiss;
+        llcmiss_ro = 0;
+    } else {
+        llcmiss_ro = target_llcmiss - llcmiss_wb;
+    }
+    DEBUG_PRINT("[%d:%u:%u]llcmiss_wb=%lu, llcmiss_ro=%lu\n", i, mon->tgid, mon->tid ,llcmiss_wb, llcmiss_ro);
+
+    *mastall_wb = 0;
+    *mastall_ro = 0;
+    // If both target_llchits and target_llcmiss are 0, it means that hit in L2.
+    // Stall by LLC misses is 0.
+    if (in->llchits || target_llcmiss) {
+        *mastall_wb = (double)(in->l2stall / cpu_freq) * ( (double)(weight * llcmiss_wb) / (double)(in->llchits + (weight * target_llcmiss)) ) * 1000;
+        *mastall_ro = (double)(in->l2stall / cpu_freq) * ( (double)(weight * llcmiss_ro) / (double)(in->llchits + (weight * target_llcmiss)) ) * 1000;
+    }
+    DEBUG_PRINT("l2stall=%" PRIu64 ", mastall_wb=%lf, mastall_ro=%lf, target_llchits=%" PRIu64 ", target_llcmiss=%" PRIu64 ", weight=%lf\n", \
+            in->l2stall, *mastall_wb, *mastall_ro, in->llchits, target_llcmiss, weight);
+}
+
+/* All the memory has the first pair of latencies. */
+static double single_delay(const struct __emul *emul, const int i, struct __monitor *mon,
+                           const struct __model_input *in)
+{
+    const double dram_latency = emul->dram_latency;
+    const struct emul_nvm_latency *emul_nvm_lats = emul->emul_nvm_lats;
+    const double factor = load_factor(i, mon, in);
+    double mastall_wb, mastall_ro;
+
+    split_stalls(emul, i, mon, in, in->llcmiss, &mastall_ro, &mastall_wb);
+    double ma_wb = mastall_wb / dram_latency;
+    double ma_ro = mastall_ro / dram_latency;
+    DEBUG_PRINT("ma_wb=%lf, ma_ro=%lf\n", ma_wb, ma_ro);
+
+    return max_delay(ma_ro * (emul_nvm_lats[0].read * factor - dram_latency) +
+                     ma_wb * (emul_nvm_lats[0].write * factor - dram_latency),
+                     bw_delay(emul, in, 0, mastall_ro, mastall_wb, 1, 1));
+}
+
+/* Read the PEBS samples of the epoch into mon->after. */
+static void hybrid_collect(const int i, struct __monitor *mon)
+{
+    if (pebs_collect(&mon->pebs_ctx, &mon->region_index, &mon->after->pebs) < 0) {
+        fprintf(stderr, "[%d:%u:%u] Warning: Failed PEBS read\n", i, mon->tgid, mon->tid);
+    }
+    if (pebs_stores_enabled() &&
+        pebs_collect(&mon->store_ctx, &mon->region_index, &mon->after->store) < 0) {
+        fprintf(stderr, "[%d:%u:%u] Warning: Failed PEBS read of stores\n", i, mon->tgid, mon->tid);
+    }
+
+    /* aim at the target number of samples in the next epoch */
+    pebs_adapt(&mon->pebs_ctx, (mon->after->pebs.nsamples - mon->before->pebs.nsamples) +
+                               (mon->after->pebs.lost - mon->before->pebs.lost));
+    if (pebs_stores_enabled()) {
+        pebs_adapt(&mon->store_ctx, (mon->after->store.nsamples - mon->before->store.nsamples) +
+                                    (mon->after->store.lost - mon->before->store.lost));
+    }
+}
+
+/*
+ * The memory accesses are divided among the regions in the proportion of
+ * the PEBS samples. The LLC misses are counted by the PEBS event.
+ */
+static double hybrid_delay(const struct __emul *emul, const int i, struct __monitor *mon,
+                           const struct __model_input *in)
+{
+    int j;
+    const double dram_latency = emul->dram_latency;
+    const struct emul_nvm_latency *emul_nvm_lats = emul->emul_nvm_lats;
+    const double factor = load_factor(i, mon, in);
+    double mastall_wb, mastall_ro;
+    uint64_t target_llcmiss = mon->after->pebs.llcmiss - mon->before->pebs.llcmiss;
+
+    split_stalls(emul, i, mon, in, target_llcmiss, &mastall_ro, &mastall_wb);
+    double ma_wb = mastall_wb / dram_latency;
+    double ma_ro = mastall_ro / dram_latency;
+
+    double rmw = 0;
+    if (media_enabled()) {
+        // The accesses combined in the buffer of the media do not suffer
+        // from its latency. The buffer is fed with the load misses only.
+        // A writeback is of a line brought by a miss, and is assumed to be
+        // combined at the same ratio; the stores, mostly hitting the
+        // caches, do not tell the locality of the writebacks. A writeback
+        // missing the buffer writes a part of a media line, which the media
+        // reads, modifies and writes: it costs a read of the media as well.
+        double miss_ratio = media_miss_ratio(mon->after->pebs.media_hits - mon->before->pebs.media_hits,
+                                             mon->after->pebs.total - mon->before->pebs.total);
+        ma_ro *= miss_ratio;
+        ma_wb *= miss_ratio;
+        rmw = 1;
+        mon->before->pebs.media_hits = mon->after->pebs.media_hits;
+        DEBUG_PRINT("[%d:%u:%u] media: miss_ratio=%lf\n", i, mon->tgid, mon->tid, miss_ratio);
+    }
+    DEBUG_PRINT("ma_wb=%lf, ma_ro=%lf\n", ma_wb, ma_ro);
+
+    double emul_delay = 0;
+    double sample = 0;
+    double sample_prop = 0;
+    double sample_total = (double)(mon->after->pebs.total - mon->before->pebs.total);
+    double lost = (double)(mon->after->pebs.lost - mon->before->pebs.lost);
+    double prev_total = 0;
+    double store_prop = 0;
+    double store_total = (double)(mon->after->store.total - mon->before->store.total);
+    for (j = 0; j < mon->num_of_region; j++) {
+        prev_total += mon->pebs_prop[j];
+    }
+    if (mon->region_index.phys) {
+        // Samples out of the physical ranges are of DRAM. Lost samples
+        // do not change the proportions.
+        sample_total = (double)(mon->after->pebs.nsamples - mon->before->pebs.nsamples);
+        store_total = (double)(mon->after->store.nsamples - mon->before->store.nsamples);
+        prev_total = 0;
+    }
+    // Lost samples are assumed to be distributed as the samples of the last epoch.
+    if (prev_total == 0) {
+        lost = 0;
+    }
+    bool total_is_zero = (sample_total + lost > 0) ? false : true;
+    if (total_is_zero && !mon->region_index.phys) {
+        // If the total is 0, divide equally.
+        sample_prop = (double)1 / (double)mon->num_of_region;
+    }
+    DEBUG_PRINT("[%d:%u:%u] pebs: total=%lu, lost=%lu\n", i, mon->tgid, mon->tid, mon->after->pebs.total, mon->after->pebs.lost);
+    for (j = 0; j < mon->num_of_region; j++) {
+        if (!total_is_zero) {
+            sample = (double)(mon->after->pebs.sample[j] - mon->before->pebs.sample[j]);
+            if (lost > 0) {
+                sample += lost * mon->pebs_prop[j] / prev_total;
+            }
+            sample_prop = sample / (sample_total + lost);
+            mon->pebs_prop[j] = sample_prop;
+        }
+        // The writebacks are divided by where the stores go, if sampled.
+        store_prop = sample_prop;
+        if (store_total > 0) {
+            store_prop = (double)(mon->after->store.sample[j] - mon->before->store.sample[j]) / store_total;
+        }
+        emul_delay += max_delay(ma_ro * sample_prop * (emul_nvm_lats[j].read * factor - dram_latency) +
+                                ma_wb * store_prop * ((emul_nvm_lats[j].write + rmw * emul_nvm_lats[j].read) * factor -
+                                                      dram_latency),
+                                bw_delay(emul, in, j, mastall_ro, mastall_wb, sample_prop, store_prop));
+        mon->before->pebs.sample[j] = mon->after->pebs.sample[j];
+        mon->before->store.sample[j] = mon->after->store.sample[j];
+        DEBUG_PRINT("[%d:%u:%u] pebs sample[%d]: =%lu, \n", i, mon->tgid, mon->tid, j, mon->after->pebs.sample[j]);
+    }
+    mon->before->pebs.total = mon->after->pebs.total;
+    mon->before->pebs.lost = mon->after->pebs.lost;
+    mon->before->pebs.nsamples = mon->after->pebs.nsamples;
+    mon->before->store.total = mon->after->store.total;
+    mon->before->store.nsamples = mon->after->store.nsamples;
+    return emul_delay;
+}
+
+/*
+ * Only the accesses to the remote node are slowed down. The stalls are
+ * divided by the mean latency of the both nodes.
+ */
+static double numa_delay(const struct __emul *emul, const int i, struct __monitor *mon,
+                         const struct __model_input *in)
+{
+    const double dram_latency = emul->dram_latency;
+    const double remote_latency = emul->remote_latency;
+    const struct emul_nvm_latency *emul_nvm_lats = emul->emul_nvm_lats;
+    const double factor = load_factor(i, mon, in);
+    double mastall_wb, mastall_ro;
+
+    /* the misses served by the remote node are also stalls on memory */
+    uint64_t target_llcmiss = in->llcmiss + in->llcrmiss;
+    split_stalls(emul, i, mon, in, target_llcmiss, &mastall_ro, &mastall_wb);
+
+    double remote_prop = 0;
+    if (target_llcmiss > 0) {
+        remote_prop = (double)in->llcrmiss / target_llcmiss;
+    }
+    double mean_latency = dram_latency * (1 - remote_prop) + remote_latency * remote_prop;
+    double ma_wb = mastall_wb / mean_latency;
+    double ma_ro = mastall_ro / mean_latency;
+    DEBUG_PRINT("[%d:%u:%u] remote_llcmiss=%" PRIu64 ", remote_prop=%lf, ma_wb=%lf, ma_ro=%lf\n",
+                i, mon->tgid, mon->tid, in->llcrmiss, remote_prop, ma_wb, ma_ro);
+
+    return max_delay(ma_ro * remote_prop * (emul_nvm_lats[0].read * factor - remote_latency) +
+                     ma_wb * remote_prop * (emul_nvm_lats[0].write * factor - remote_latency),
+                     bw_delay(emul, in, 0, mastall_ro, mastall_wb, remote_prop, remote_prop));
+}
+
+const struct __model single_model = { "single", NULL, single_delay };
+const struct __model hybrid_model = { "hybrid", hybrid_collect, hybrid_delay };
+const struct __model numa_model = { "numa", NULL, numa_delay };
+
+/*
+ * The model of a monitor being activated. model is the one chosen at the
+ * start by the options. A thread informing the emulator of its memory
+ * regions is emulated as hybrid memory.
+ */
+const struct __model *select_model(const struct __model *model, const struct __monitor *mon)
+{
+    if (model == &single_model && mon->num_of_region >= 2) {
+        return &hybrid_model;
+    }
+    return model;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#ifndef __MODEL_H
+#define __MODEL_H
+#include <stdint.h>
+#include <stdbool.h>
+
+struct __emul;
+struct __epoch;
+struct __monitor;
+
+/* The counter values of a monitor in an epoch, i.e., after - before. */
+struct __model_input {
+    uint64_t wb_cnt;            /* LLC writebacks of all the CBos */
+    uint64_t cpus_dram_rds;     /* DRAM reads of all the CPU cores */
+    uint64_t l2stall;
+    uint64_t llchits;
+    uint64_t llcmiss;           /* LLC misses served by the local DRAM */
+    uint64_t llcrmiss;          /* LLC misses served by the remote node, with -N */
+    uint64_t imc_rd;            /* CAS reads of all the IMCs, with -B */
+    uint64_t imc_wr;            /* CAS writes of all the IMCs, with -B */
+    uint64_t epoch_nsec;        /* the length of the epoch */
+    /*
+     * The outstanding offcore data reads summed over the cycles, with -q.
+     * load_factor() divides it by offcore_cyc for the mean occupancy.
+     */
+    uint64_t offcore_occ;
+    uint64_t offcore_cyc;       /* cycles with any outstanding offcore data read, with -q */
+};
+
+/* The maximum number of the points of the load curve */
+#define MODEL_MAX_LOAD_POINTS 32
+
+/*
+ * A latency model. delay() returns the delay in nsec to be injected to the
+ * i-th monitor for the epoch, with its fraction; see delay_carry. A
+ * monitor has its model chosen when it is activated, so that the models
+ * are not switched in the epoch loop.
+ */
+struct __model {
+    const char *name;
+    /* read the samples of the epoch before delay(), NULL if not needed */
+    void (*collect)(const int, struct __monitor *);
+    double (*delay)(const struct __emul *, const int, struct __monitor *, const struct __model_input *);
+};
+
+extern const struct __model single_model;   /* one memory region */
+extern const struct __model hybrid_model;   /* regions told apart by PEBS */
+extern const struct __model numa_model;     /* the remote NUMA node, see -N */
+
+void read_model_input(const struct __monitor *, const struct __epoch *, struct __model_input *);
+const struct __model *select_model(const struct __model *, const struct __monitor *);
+int model_add_load_point(const double, const double);
+bool model_load_enabled(void);
+#endif
@@ -6,42 +6,196 @@
 
 #define _GNU_SOURCE
 #include <sched.h>
+#include <pthread.h>
 #include <sys/syscall.h>
 #include "monitor.h"
 #include "pebs.h"
+#include "incores.h"
+#include "uncores.h"
+#include "perf.h"
+#include "snapshot.h"
+
+/*
+ * Monitors are enabled by the control thread and terminated by the epoch
+ * loop. The lock protects the allocation and the release of the slots.
+ */
+static pthread_mutex_t mons_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Index of the monitor slots, built by initMon(). Enabled monitors are
+ * found by (tgid, tid) in a chained hash table, and disabled slots are kept
+ * in a stack. Only the slots activated in the epoch loop are in the active
+ * list, which is changed between epochs only.
+ */
+struct __mon_index {
+    uint32_t tnum;
+    uint32_t mask;          /* the number of buckets - 1 */
+    int *buckets;           /* the first slot of a hash chain, or -1 */
+    int *next;              /* the next slot in a hash chain, or -1 */
+    int *free_slots;
+    uint32_t nfree;
+    int *active;
+    int *active_pos;        /* the position in the active list, or -1 */
+    uint32_t nactive;
+    struct __monitor *mons;
+    bool multiplex;         /* threads share the reserved cores, see initMon() */
+    cpu_set_t cpuset;
+    int nphys;              /* the number of the physical ranges of -P */
+    struct __region_info *phys;
+};
+static struct __mon_index mon_index;
+
+static inline uint32_t hash_mon(const uint32_t tgid, const uint32_t tid)
+{
+    return ((tid * 0x9e3779b1U) ^ tgid) & mon_index.mask;
+}
+
+static int lookup_mon(const uint32_t tgid, const uint32_t tid, const struct __monitor* mon)
+{
+    int i;
+
+    for (i = mon_index.buckets[hash_mon(tgid, tid)]; i >= 0; i = mon_index.next[i]) {
+        if (mon[i].tgid == tgid && mon[i].tid == tid) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void insert_mon(const int target, const uint32_t tgid, const uint32_t tid)
+{
+    uint32_t h = hash_mon(tgid, tid);
+
+    mon_index.next[target] = mon_index.buckets[h];
+    mon_index.buckets[h] = target;
+}
+
+static void remove_mon(const int target, const uint32_t tgid, const uint32_t tid)
+{
+    int *p = &mon_index.buckets[hash_mon(tgid, tid)];
+
+    while (*p >= 0) {
+        if (*p == target) {
+            *p = mon_index.next[target];
+            break;
+        }
+        p = &mon_index.next[*p];
+    }
+    mon_index.next[target] = -1;
+}
+
+static void deactivate_mon(const int target)
+{
+    int pos = mon_index.active_pos[target];
+    int last;
+
+    if (pos < 0) {
+        return;
+    }
+    last = mon_index.active[--mon_index.nactive];
+    mon_index.active[pos] = last;
+    mon_index.active_pos[last] = pos;
+    mon_index.active_pos[target] = -1;
+}
+
+/* Return the PEBS context of the monitor of (tgid, tid), or NULL. */
+struct pebs_context *lookup_mon_pebs(const uint32_t tgid, const uint32_t tid, const enum pebs_kind kind)
+{
+    int target;
+
+    pthread_mutex_lock(&mons_lock);
+    target = lookup_mon(tgid, tid, mon_index.mons);
+    pthread_mutex_unlock(&mons_lock);
+    if (target < 0) {
+        return NULL;
+    }
+    return (kind == PEBS_STORE) ? &mon_index.mons[target].store_ctx : &mon_index.mons[target].pebs_ctx;
+}
+
+/* Return the slot to the free stack. */
+static void release_mon(const int target, struct __monitor* mon)
+{
+    pthread_mutex_lock(&mons_lock);
+    remove_mon(target, mon[target].tgid, mon[target].tid);
+    deactivate_mon(target);
+    disable_mon(target, mon);
+    mon_index.free_slots[mon_index.nfree++] = target;
+    pthread_mutex_unlock(&mons_lock);
+}
+
+static int init_mon_pmc(struct __monitor* mon)
+{
+    int i;
+
+    mon->incore = (struct __incore *)calloc(sizeof(struct __incore), 1);
+    if (mon->incore == NULL) {
+        handle_error("calloc");
+    }
+    if (init_pmc(mon->incore, mon->tid, -1) < 0 || start_pmc(mon->incore) < 0) {
+        for (i = 0; i < mon->incore->nevents; i++) {
+            perf_fini(&mon->incore->perf[i]);
+        }
+        for (i = 0; i < mon->incore->nload; i++) {
+            perf_fini(&mon->incore->load[i]);
+        }
+        free(mon->incore);
+        mon->incore = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void fini_mon_pmc(struct __monitor* mon)
+{
+    if (mon->incore == NULL) {
+        return;
+    }
+    fini_pmc(mon->incore);
+    free(mon->incore);
+    mon->incore = NULL;
+}
 
 void disable_mon(const uint32_t target, struct __monitor* mon)
 {
     mon[target].is_process = false;
     mon[target].status = MONITOR_DISABLE;
+    mon[target].epoch_stopped = false;
+    mon[target].resume_scheduled = false;
     mon[target].tgid = 0;
     mon[target].tid = 0;
     mon[target].before = &mon[target].elem[0];
     mon[target].after = &mon[target].elem[1];
     mon[target].total_delay = 0;
+    mon[target].delay_carry = 0;
     mon[target].squabble_delay.tv_sec = 0;
     mon[target].squabble_delay.tv_nsec = 0;
     mon[target].injected_delay.tv_sec = 0;
     mon[target].injected_delay.tv_nsec = 0;
     mon[target].end_exec_ts.tv_sec = 0;
     mon[target].end_exec_ts.tv_nsec = 0;
-    mon[target].pebs_ctx.fd     = -1;
-    mon[target].pebs_ctx.pid    = -1;
-    mon[target].pebs_ctx.seq    = 0;
-    mon[target].pebs_ctx.rdlen  = 0;
-    mon[target].pebs_ctx.seq    = 0;
-    mon[target].pebs_ctx.mp     = NULL;
-    mon[target].pebs_ctx.sample_period = 0;
+    pebs_reset(&mon[target].pebs_ctx, mon[target].num_of_region);
+    pebs_reset(&mon[target].store_ctx, mon[target].num_of_region);
+    mon[target].incore = NULL;
+    mon[target].model = NULL;
     for (int i = 0; i < mon[target].num_of_region; i++) {
         for (int j = 0; j < 2; j++) {
             mon[target].elem[j].pebs.sample[i] = 0;
             mon[target].elem[j].pebs.total = 0;
             mon[target].elem[j].pebs.llcmiss = 0;
+            mon[target].elem[j].pebs.lost = 0;
+            mon[target].elem[j].pebs.nsamples = 0;
+            mon[target].elem[j].pebs.media_hits = 0;
+            mon[target].elem[j].store.sample[i] = 0;
+            mon[target].elem[j].store.total = 0;
+            mon[target].elem[j].store.nsamples = 0;
+            mon[target].elem[j].store.media_hits = 0;
         }
+        mon[target].pebs_prop[i] = 0;
         mon[target].region_info[i].addr = 0;
         mon[target].region_info[i].size = 0;
     }
     mon[target].num_of_region = 0;
+    clear_region_index(&mon[target].region_index);
 }
 
 int enable_mon(const uint32_t tgid, const uint32_t tid, bool is_process,
@@ -50,31 +204,32 @@ int enable_mon(const uint32_t tgid, const uint32_t tid, bool is_process,
 {
     int target = -1;
 
-    for (int i = 0; i < tnum; i++) {
-        if (mon[i].tgid == tgid && mon[i].tid == tid) {
-            // already exists.
-            return -1;
-        }
-    }
-    for (int i = 0; i < tnum; i++) {
-        if (mon[i].status != MONITOR_DISABLE) {
-            continue;
-        }
-        target = i;
-        break;
+    pthread_mutex_lock(&mons_lock);
+    if (lookup_mon(tgid, tid, mon) >= 0) {
+        // already exists.
+        pthread_mutex_unlock(&mons_lock);
+        return -1;
     }
-    if (target == -1) {
+    if (mon_index.nfree == 0) {
         // All cores are used.
+        pthread_mutex_unlock(&mons_lock);
         return -1;
     }
+    target = mon_index.free_slots[mon_index.nfree - 1];
 
     /* set CPU affinity to not used core. */
     int s;
     cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(mon[target].cpu_core, &cpuset);
+    if (mon_index.multiplex) {
+        /* the thread can migrate among the reserved cores */
+        cpuset = mon_index.cpuset;
+    } else {
+        CPU_ZERO(&cpuset);
+        CPU_SET(mon[target].cpu_core, &cpuset);
+    }
     s = sched_setaffinity(tid, sizeof(cpu_set_t), &cpuset);
     if (s != 0) {
+        pthread_mutex_unlock(&mons_lock);
         if (errno == ESRCH) {
             DEBUG_PRINT("Process [%u:%u] is terminated.\n", tgid, tid);
             return -2;
@@ -85,17 +240,39 @@ int enable_mon(const uint32_t tgid, const uint32_t tid, bool is_process,
     }
 
     /* init */
+    mon_index.nfree--;
     disable_mon(target, mon);
-    mon[target].status = MONITOR_ON;
+    mon[target].status = MONITOR_PENDING;
     mon[target].tgid = tgid;
     mon[target].tid = tid;
     mon[target].is_process = is_process;
+    insert_mon(target, tgid, tid);
+    pthread_mutex_unlock(&mons_lock);
+
+    if (mon_index.multiplex) {
+        /* count the in-core events of the thread wherever it runs */
+        if (init_mon_pmc(&mon[target]) < 0) {
+            release_mon(target, mon);
+            DEBUG_PRINT("Process [%u:%u] is terminated.\n", tgid, tid);
+            return -2;
+        }
+    }
 
     if (pebs_sample_period) {
         /* pebs start */
         pebs_init(&mon[target].pebs_ctx, tid, pebs_sample_period);
+        if (pebs_stores_enabled()) {
+            pebs_init(&mon[target].store_ctx, tid, pebs_sample_period);
+        }
         DEBUG_PRINT("Process [tgid=%u, tid=%u]: enable to pebs.\n",
                     mon[target].tgid, mon[target].tid);
+        if (mon_index.nphys > 0) {
+            /* the samples are classified by their physical addresses */
+            mon[target].region_index.phys = true;
+            if (set_region_info_mon(&mon[target], mon_index.nphys, mon_index.phys) < 0) {
+                exit_with_message("Overlapping physical ranges\n");
+            }
+        }
     }
 
     printf("========== Process %d[tgid=%u, tid=%u] monitoring start ==========\n",
@@ -107,42 +284,120 @@ int enable_mon(const uint32_t tgid, const uint32_t tid, bool is_process,
 int terminate_mon(const uint32_t tgid, const uint32_t tid,
               const int32_t tnum, struct __monitor* mon)
 {
-    int target = -1;
+    int target;
 
-    for (int i = 0; i < tnum; i++) {
-        if (mon[i].status == MONITOR_DISABLE) {
-            continue;
-        }
-        if (mon[i].tgid != tgid || mon[i].tid != tid) {
-            continue;
-        }
-        target = i;
-        /* pebs stop */
-        pebs_fini(&mon[target].pebs_ctx);
+    pthread_mutex_lock(&mons_lock);
+    target = lookup_mon(tgid, tid, mon);
+    pthread_mutex_unlock(&mons_lock);
+    if (target < 0) {
+        return -1;
+    }
 
-        /* Save end time */
-        if (mon[target].end_exec_ts.tv_sec == 0 && mon[target].end_exec_ts.tv_nsec == 0) {
-            clock_gettime(CLOCK_MONOTONIC, &mon[i].end_exec_ts);
-        }
-        /* display results */
-        printf("========== Process %d[tgid=%u, tid=%u] statistics summary ==========\n",
-               target, mon[target].tgid, mon[target].tid);
-        double emulated_time = (double)(mon[target].end_exec_ts.tv_sec - mon[target].start_exec_ts.tv_sec) +
-                               (double)(mon[target].end_exec_ts.tv_nsec - mon[target].start_exec_ts.tv_nsec)/1000000000;
-        printf("emulated time =%lf\n", emulated_time);
-        printf("total delay   =%lf\n", mon[target].total_delay);
-        for (int j; j < mon[target].num_of_region; j++) {
-            printf("PEBS sample %d =%lu\n", j, mon[target].before->pebs.sample[j]);
-        }
+    /* pebs stop */
+    pebs_fini(&mon[target].pebs_ctx);
+    pebs_fini(&mon[target].store_ctx);
+    fini_mon_pmc(&mon[target]);
 
-        /* init */
-        disable_mon(target, mon);
-        break;
+    /* Save end time */
+    if (mon[target].end_exec_ts.tv_sec == 0 && mon[target].end_exec_ts.tv_nsec == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &mon[target].end_exec_ts);
+    }
+    /* display results */
+    printf("========== Process %d[tgid=%u, tid=%u] statistics summary ==========\n",
+           target, mon[target].tgid, mon[target].tid);
+    double emulated_time = (double)(mon[target].end_exec_ts.tv_sec - mon[target].start_exec_ts.tv_sec) +
+                           (double)(mon[target].end_exec_ts.tv_nsec - mon[target].start_exec_ts.tv_nsec)/1000000000;
+    printf("emulated time =%lf\n", emulated_time);
+    printf("total delay   =%lf\n", mon[target].total_delay);
+    if (mon[target].pebs_ctx.sample_period) {
+        /* the mean of the periods, which change with pebs_adapt() */
+        uint64_t nsamples = mon[target].before->pebs.nsamples + mon[target].before->pebs.lost;
+        printf("PEBS period   =%lu (effective %lf)\n", mon[target].pebs_ctx.sample_period,
+               nsamples ? (double)mon[target].before->pebs.llcmiss / nsamples : 0);
     }
+    for (int j; j < mon[target].num_of_region; j++) {
+        printf("PEBS sample %d =%lu\n", j, mon[target].before->pebs.sample[j]);
+    }
+
+    /* init */
+    release_mon(target, mon);
 
     return target;
 }
 
+/*
+ * Start the emulation of a monitor enabled by enable_mon() with the model.
+ * It must be called by the epoch loop between epochs, with the snapshot of
+ * the last epoch: its DRAM reads of all the CPU cores are the baseline of
+ * the monitor, which read_mon_baseline() does not read. snap is NULL if the
+ * baseline is all read.
+ */
+void activate_mon(const uint32_t target, struct __monitor* mon, const struct __model *model,
+                  const struct __snapshot *snap)
+{
+    if (mon[target].status != MONITOR_PENDING) {
+        return;
+    }
+    if (snap != NULL) {
+        mon[target].before->all_dram_rds = snap->all_dram_rds;
+    }
+    mon[target].model = select_model(model, &mon[target]);
+    mon[target].status = MONITOR_ON;
+    mon_index.active_pos[target] = mon_index.nactive;
+    mon_index.active[mon_index.nactive++] = target;
+}
+
+/* The number of the monitors in the active list */
+uint32_t nr_active_mons(void)
+{
+    return mon_index.nactive;
+}
+
+/* The slot of the k-th monitor in the active list */
+int active_mon(const uint32_t k)
+{
+    return mon_index.active[k];
+}
+
+/*
+ * Copy the counter values of the monitor from the snapshot. The in-core
+ * events are read from the thread itself if they are counted per thread.
+ */
+void read_mon_elem(const struct __monitor* mon, const struct __snapshot *snap, struct __elem *elem)
+{
+    copy_snapshot_elem(snap, mon->cpu_core, elem);
+    if (mon->incore != NULL) {
+        if (read_cpu_elems(mon->incore, &elem->cpu) < 0) {
+            fprintf(stderr, "[%u:%u] Warning: Failed to read the in-core events\n", mon->tgid, mon->tid);
+        }
+    }
+}
+
+/*
+ * Read the baseline of a new monitor, stopped by the caller, into elem. Only
+ * the CBos, the IMCs and the CPU core of the monitor are read, or the events
+ * of the thread itself if they are counted per thread. The DRAM reads of all
+ * the CPU cores are taken from the snapshot of the epoch loop when the
+ * monitor is activated, see activate_mon().
+ */
+void read_mon_baseline(const struct __monitor *mon, struct __pmu_info *pmu, struct __snapshot *snap,
+                       struct __elem *elem)
+{
+    int i;
+
+    for (i = 0; i < num_of_cbo(); i++) {
+        read_cbo_elems(&pmu->cbos[i], &snap->cbos[i]);
+    }
+    for (i = 0; i < pmu->nimc; i++) {
+        read_imc_elems(&pmu->imcs[i], &snap->imcs[i]);
+    }
+    if (mon->incore == NULL) {
+        read_cpu_elems(&pmu->cpus[mon->cpu_core], &snap->cpus[mon->cpu_core]);
+    }
+    sum_snapshot(snap);
+    read_mon_elem(mon, snap, elem);
+}
+
 int set_region_info_mon(struct __monitor *mon, const int nreg, struct __region_info *ri)
 {
     int i;
@@ -154,10 +409,39 @@ int set_region_info_mon(struct __monitor *mon, const int nreg, struct __region_i
         DEBUG_PRINT("  region info[%d]: addr=%lx, size=%lx\n", i, ri[i].addr, ri[i].size);
     }
 
-    return 0;
+    /* to find the region of a PEBS sample by a binary search */
+    if (build_region_index(&mon->region_index, nreg, mon->region_info) < 0) {
+        return -1;
+    }
+    if (pebs_set_regions(&mon->store_ctx, &mon->region_index) < 0) {
+        return -1;
+    }
+    return pebs_set_regions(&mon->pebs_ctx, &mon->region_index);
+}
+
+/*
+ * Emulate the physical address ranges instead of the regions informed by
+ * target threads. The i-th range has the i-th latencies, and the memory out
+ * of the ranges is DRAM. It is called before any monitor is enabled.
+ */
+void set_phys_regions_mon(const int nphys, struct __region_info *phys)
+{
+    mon_index.nphys = nphys;
+    mon_index.phys = phys;
 }
 
-void initMon(const int tnum, cpu_set_t *use_cpuset, struct __monitor** monp, const int nmem)
+bool phys_regions_mon(void)
+{
+    return mon_index.nphys > 0;
+}
+
+/*
+ * Allocate tnum monitors. Without multiplex, the i-th monitor has the i-th
+ * reserved CPU core to itself. With multiplex, monitored threads share and
+ * migrate among all the reserved cores, and their in-core events are counted
+ * per thread. tnum is then not limited by the number of the cores.
+ */
+void initMon(const int tnum, cpu_set_t *use_cpuset, struct __monitor** monp, const int nmem, const bool multiplex)
 {
     int i, j;
     struct __monitor *mon;
@@ -168,15 +452,41 @@ void initMon(const int tnum, cpu_set_t *use_cpuset, struct __monitor** monp, con
     }
     *monp = mon;
 
+    mon_index.tnum = tnum;
+    mon_index.mons = mon;
+    mon_index.multiplex = multiplex;
+    mon_index.cpuset = *use_cpuset;
+    for (j = 1; j < 2 * tnum; j <<= 1)
+        ;
+    mon_index.mask = j - 1;
+    mon_index.buckets = (int *)malloc(sizeof(int) * j);
+    mon_index.next = (int *)malloc(sizeof(int) * tnum);
+    mon_index.free_slots = (int *)malloc(sizeof(int) * tnum);
+    mon_index.active = (int *)malloc(sizeof(int) * tnum);
+    mon_index.active_pos = (int *)malloc(sizeof(int) * tnum);
+    if (mon_index.buckets == NULL || mon_index.next == NULL || mon_index.free_slots == NULL ||
+        mon_index.active == NULL || mon_index.active_pos == NULL) {
+        handle_error("malloc");
+    }
+    for (i = 0; i <= mon_index.mask; i++) {
+        mon_index.buckets[i] = -1;
+    }
+    mon_index.nfree = 0;
+    mon_index.nactive = 0;
+
     /* init mon */
     for (i = 0; i < tnum; i++) {
         disable_mon(i, mon);
+        mon_index.next[i] = -1;
+        mon_index.active_pos[i] = -1;
+        /* the slot 0 is used first */
+        mon_index.free_slots[mon_index.nfree++] = tnum - 1 - i;
 
         int cpucnt = 0;
         int cpuid = 0;
         for (cpuid = 0; cpuid < num_of_cpu(); cpuid++) {
             if (CPU_ISSET(cpuid, use_cpuset)) {
-                if (i == cpucnt) {
+                if (i % CPU_COUNT(use_cpuset) == cpucnt) {
                     mon[i].cpu_core = cpuid;
                     break;
                 }
@@ -185,16 +495,9 @@ void initMon(const int tnum, cpu_set_t *use_cpuset, struct __monitor** monp, con
         }
 
         for (j = 0; j < 2; j++) {
-            mon[i].elem[j].cpus = (struct __cpu_elem *)calloc(sizeof(struct __cpu_elem), num_of_cpu());
-            if (mon[i].elem[j].cpus == NULL) {
-                handle_error("calloc");
-            }
-            mon[i].elem[j].cbos = (struct __cbo_elem *)calloc(sizeof(struct __cbo_elem), num_of_cbo());
-            if (mon[i].elem[j].cbos == NULL) {
-                handle_error("calloc");
-            }
             mon[i].elem[j].pebs.sample = (uint64_t *)calloc(sizeof(uint64_t), nmem);
-            if (mon[i].elem[j].pebs.sample == NULL) {
+            mon[i].elem[j].store.sample = (uint64_t *)calloc(sizeof(uint64_t), nmem);
+            if (mon[i].elem[j].pebs.sample == NULL || mon[i].elem[j].store.sample == NULL) {
                 handle_error("calloc");
             }
         }
@@ -202,6 +505,17 @@ void initMon(const int tnum, cpu_set_t *use_cpuset, struct __monitor** monp, con
         if (mon[i].region_info == NULL) {
             handle_error("calloc");
         }
+        mon[i].pebs_prop = (double *)calloc(sizeof(double), nmem);
+        if (mon[i].pebs_prop == NULL) {
+            handle_error("calloc");
+        }
+        if (init_region_index(&mon[i].region_index, nmem) < 0) {
+            handle_error("calloc");
+        }
+        if (pebs_setup(&mon[i].pebs_ctx, nmem, PEBS_LOAD) < 0 ||
+            pebs_setup(&mon[i].store_ctx, nmem, PEBS_STORE) < 0) {
+            handle_error("calloc");
+        }
     }
 }
 
@@ -212,13 +526,21 @@ void freeMon(const int tnum, struct __monitor** monp)
 
     for (i = 0; i < tnum; i++) {
         for (j = 0; j < 2; j++) {
-            free(mon[i].elem[j].cpus);
-            free(mon[i].elem[j].cbos);
             free(mon[i].elem[j].pebs.sample);
+            free(mon[i].elem[j].store.sample);
         }
         free(mon[i].region_info);
+        free(mon[i].pebs_prop);
+        fini_region_index(&mon[i].region_index);
+        pebs_cleanup(&mon[i].pebs_ctx);
+        pebs_cleanup(&mon[i].store_ctx);
     }
     free(mon);
+    free(mon_index.buckets);
+    free(mon_index.next);
+    free(mon_index.free_slots);
+    free(mon_index.active);
+    free(mon_index.active_pos);
 }
 
 void stop_all_mons(const uint32_t processes, struct __monitor* mons)
@@ -314,19 +636,44 @@ void clear_mon_time(struct timespec* time)
     time->tv_nsec = 0;
 }
 
+/* Add nsec to the time, keeping tv_nsec less than a second. */
+void add_mon_time(struct timespec* time, const uint64_t nsec)
+{
+    time->tv_sec += nsec / 1000000000;
+    time->tv_nsec += nsec % 1000000000;
+    if (time->tv_nsec >= 1000000000) {
+        time->tv_sec++;
+        time->tv_nsec -= 1000000000;
+    }
+}
+
+uint64_t mon_time_to_nsec(const struct timespec* time)
+{
+    return (uint64_t)time->tv_sec * 1000000000 + time->tv_nsec;
+}
+
 bool check_all_mons_terminated(const uint32_t processes, struct __monitor* mons)
 {
     bool _terminated = true;
-    for(uint32_t i = 0; i < processes ; ++i) {
+    uint32_t k;
+
+    /* terminate_mon() moves the last one of the active list to the k-th */
+    for (k = mon_index.nactive; k-- > 0;) {
+        int i = mon_index.active[k];
         if (mons[i].status == MONITOR_ON || mons[i].status == MONITOR_OFF) {
             _terminated = false;
-        } else if (mons[i].status != MONITOR_DISABLE) {
+        } else {
             if (terminate_mon(mons[i].tgid, mons[i].tid, processes, mons) < 0) {
                 handle_error("Failed to terminate monitor");
                 exit(1);
             }
         }
     }
+    /* monitors not yet handed over by the control thread */
+    pthread_mutex_lock(&mons_lock);
+    if (mon_index.tnum - mon_index.nfree > mon_index.nactive) {
+        _terminated = false;
+    }
+    pthread_mutex_unlock(&mons_lock);
     return _terminated;
 }
-
@@ -9,6 +9,8 @@
 #include "types.h"
 #include "common.h"
 #include "pebs.h"
+#include "region.h"
+#include "model.h"
 #include <string.h>
 #include <signal.h>
 #include <errno.h>
@@ -21,6 +23,7 @@ enum MONITOR_STATUS {
     MONITOR_TERMINATED = 2,
     MONITOR_NOPERMISSION = 3,
     MONITOR_DISABLE = 4,
+    MONITOR_PENDING = 5,    /* registered, but not yet handed to the epoch loop */
     MONITOR_UNKNOWN = 0xff
 };
 
@@ -29,24 +32,41 @@ struct __monitor {
     pid_t tid;
     uint32_t cpu_core;
     char status;
+    bool epoch_stopped;             /* stopped for the calculation of the current epoch */
+    bool resume_scheduled;          /* stopped until the deadline in the resume scheduler */
+    struct timespec epoch_start_ts;
     struct timespec injected_delay;
     struct timespec wasted_delay;
     struct timespec squabble_delay;
     struct __elem elem[2];
     struct __elem *before, *after;
     double total_delay;
+    double delay_carry;             /* nsec owed to the next epochs, or the overhead credit if negative */
     struct timespec start_exec_ts, end_exec_ts;
     bool is_process;
     int num_of_region;
     struct __region_info *region_info;
+    struct __region_index region_index;
+    double *pebs_prop;              /* the proportions of the regions in the last epoch */
     struct pebs_context pebs_ctx;
+    struct pebs_context store_ctx;
+    struct __incore *incore;        /* per-thread in-core events, NULL if counted per CPU core */
+    const struct __model *model;    /* set by activate_mon() */
 };
 
 void disable_mon(const uint32_t, struct __monitor*);
 int enable_mon(const uint32_t,  const uint32_t, bool, uint64_t, const int32_t, struct __monitor*);
 int terminate_mon(const uint32_t, const uint32_t, const int32_t, struct __monitor*);
+void activate_mon(const uint32_t, struct __monitor*, const struct __model *, const struct __snapshot *);
+uint32_t nr_active_mons(void);
+int active_mon(const uint32_t);
+struct pebs_context *lookup_mon_pebs(const uint32_t, const uint32_t, const enum pebs_kind);
+void read_mon_elem(const struct __monitor*, const struct __snapshot *, struct __elem *);
+void read_mon_baseline(const struct __monitor *, struct __pmu_info *, struct __snapshot *, struct __elem *);
 int set_region_info_mon(struct __monitor *, const int, struct __region_info *);
-void initMon(const int, cpu_set_t *, struct __monitor**, const int);
+void set_phys_regions_mon(const int, struct __region_info *);
+bool phys_regions_mon(void);
+void initMon(const int, cpu_set_t *, struct __monitor**, const int, const bool);
 void freeMon(const int, struct __monitor**);
 void stop_all_mons(const uint32_t, struct __monitor*);
 void run_all_mons(const uint32_t, struct __monitor*);
@@ -54,6 +74,8 @@ void stop_mon(struct __monitor*);
 void run_mon(struct __monitor*);
 bool check_continue_mon(const uint32_t, const struct __monitor*, const struct timespec);
 void clear_mon_time(struct timespec*);
+void add_mon_time(struct timespec*, const uint64_t);
+uint64_t mon_time_to_nsec(const struct timespec*);
 bool check_all_mons_terminated(const uint32_t, struct __monitor*);
 #endif
 
@@ -16,16 +16,19 @@
 #include <unistd.h>
 #include <x86intrin.h>
 #include <asm/unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include "pebs.h"
+#include "heatmap.h"
 
 #define PAGE_SIZE 4096
-#define DATA_SIZE PAGE_SIZE
-#define MMAP_SIZE (PAGE_SIZE + DATA_SIZE)
+#define PEBS_BATCH 64
+#define PEBS_DRAIN_EVENTS 64
 
 #define barrier() _mm_mfence()
 
@@ -39,6 +42,71 @@ struct __attribute__((packed)) perf_sample {
 	uint64_t phys_addr;
 };
 
+struct __attribute__((packed)) perf_lost {
+	struct perf_event_header header;
+	uint64_t id;
+	uint64_t lost;
+};
+
+struct __attribute__((packed)) perf_lost_samples {
+	struct perf_event_header header;
+	uint64_t lost;
+};
+
+/* the number of data pages of the ring buffer: a power of 2 */
+static int pebs_data_pages = PEBS_DEFAULT_PAGES;
+
+/* the drain thread, see pebs_start_drain() */
+static bool pebs_async = false;
+static int pebs_epfd = -1;
+static int pebs_evfd = -1;
+static pthread_t pebs_drain_thread;
+
+/* sample stores in addition to loads, see pebs_enable_stores() */
+static bool pebs_stores = false;
+
+/* samples aimed at in an epoch, 0 if the period is fixed. see pebs_adapt() */
+static uint64_t pebs_target = 0;
+
+/* the per-CPU buffers, see pebs_start_percpu() */
+static struct pebs_context *pebs_cpus = NULL;
+static int pebs_nrings = 0;
+static pebs_lookup_t pebs_lookup = NULL;
+
+int
+pebs_set_data_pages(const int npages)
+{
+	if (npages <= 0 || (npages & (npages - 1)) != 0) {
+		return -1;
+	}
+	pebs_data_pages = npages;
+	return 0;
+}
+
+/*
+ * Sample retired stores of the target threads as well as LLC load misses,
+ * to find the regions where the writes go. It must be called before any
+ * pebs_init().
+ */
+void
+pebs_enable_stores(void)
+{
+	pebs_stores = true;
+}
+
+bool
+pebs_stores_enabled(void)
+{
+	return pebs_stores;
+}
+
+/* Retune the period of each thread to take about nsamples in an epoch. */
+void
+pebs_set_target(const uint64_t nsamples)
+{
+	pebs_target = nsamples;
+}
+
 long
 perf_event_open(struct perf_event_attr* event_attr, pid_t pid,
 		int cpu, int group_fd, unsigned long flags)
@@ -47,50 +115,203 @@ perf_event_open(struct perf_event_attr* event_attr, pid_t pid,
 		       cpu, group_fd, flags);
 }
 
+/* Allocate the context of a monitor slot. It is reused by pebs_init(). */
 int
-pebs_init(struct pebs_context *ctx, pid_t pid, uint64_t sample_period)
+pebs_setup(struct pebs_context *ctx, const int nmem, const enum pebs_kind kind)
 {
-	ctx->pid    = pid;
-	ctx->sample_period = sample_period;
+	ctx->fd = -1;
+	ctx->cpu = -1;
+	ctx->kind = kind;
+	ctx->mp = MAP_FAILED;
+	ctx->idx = NULL;
+	memset(&ctx->acc, 0, sizeof(ctx->acc));
+	ctx->acc.sample = calloc(sizeof(uint64_t), nmem);
+	if (ctx->acc.sample == NULL) {
+		perror("calloc");
+		return -1;
+	}
+	if (pthread_mutex_init(&ctx->lock, NULL) != 0) {
+		fprintf(stderr, "%s pthread_mutex_init failed\n", __func__);
+		return -1;
+	}
+	if (kind == PEBS_STORE) {
+		/* the media buffer is fed with the load misses only */
+		memset(&ctx->media, 0, sizeof(ctx->media));
+		return 0;
+	}
+	return init_media_buffer(&ctx->media);
+}
+
+/* Reset the context of a monitor slot released by pebs_fini(). */
+void
+pebs_reset(struct pebs_context *ctx, const int nreg)
+{
+	int i;
+
+	ctx->fd     = -1;
+	ctx->pid    = -1;
+	ctx->seq    = 0;
+	ctx->rdlen  = 0;
+	ctx->mp     = MAP_FAILED;
+	ctx->sample_period = 0;
+	ctx->min_period = 0;
+	for (i = 0; i < nreg; i++) {
+		ctx->acc.sample[i] = 0;
+	}
+	ctx->acc.total   = 0;
+	ctx->acc.llcmiss = 0;
+	ctx->acc.lost    = 0;
+	ctx->acc.nsamples = 0;
+	ctx->acc.media_hits = 0;
+	reset_media_buffer(&ctx->media);
+}
+
+void
+pebs_cleanup(struct pebs_context *ctx)
+{
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx->acc.sample);
+	ctx->acc.sample = NULL;
+	fini_media_buffer(&ctx->media);
+}
+
+/* Open the PEBS event of a thread (cpu = -1) or a CPU core (pid = -1). */
+static int
+pebs_open(struct pebs_context *ctx, pid_t pid, int cpu, uint64_t sample_period)
+{
+	int fd;
+	size_t data_size = (size_t)pebs_data_pages * PAGE_SIZE;
+	struct perf_event_mmap_page *mp;
 
 	// Configure perf_event_attr struct
 	struct perf_event_attr pe;
 	memset(&pe, 0, sizeof(struct perf_event_attr));
 	pe.type = PERF_TYPE_RAW;
 	pe.size = sizeof(struct perf_event_attr);
-	pe.config = 0x20d1; // mem_load_retired.l3_miss
-	pe.config1 = 3;
+	if (ctx->kind == PEBS_STORE) {
+		pe.config = 0x82d0; // mem_inst_retired.all_stores
+	} else {
+		pe.config = 0x20d1; // mem_load_retired.l3_miss
+		pe.config1 = 3;
+	}
 	pe.disabled = 1;    // Event is initially disabled
 	pe.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED;
 	pe.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_ADDR | PERF_SAMPLE_READ | PERF_SAMPLE_PHYS_ADDR;
-	pe.sample_period = ctx->sample_period;
+	pe.sample_period = sample_period;
 	pe.precise_ip = 1;
 	pe.exclude_kernel = 1; // excluding events that happen in the kernel-space
+	if (pebs_async) {
+		// wake up the drain thread when a quarter of the buffer is filled
+		pe.watermark = 1;
+		pe.wakeup_watermark = data_size / 4;
+	}
 
-	int cpu = -1;   // measure on any cpu
 	int group_fd = -1;
 	unsigned long flags = 0;
 
-	ctx->fd = perf_event_open(&pe, ctx->pid, cpu, group_fd, flags);
-	if (ctx->fd == -1) {
+	fd = perf_event_open(&pe, pid, cpu, group_fd, flags);
+	if (fd == -1) {
 		perror("perf_event_open");
 		return -1;
 	}
 
-        ctx->mplen = MMAP_SIZE;
-	ctx->mp = mmap(NULL, MMAP_SIZE, PROT_READ | PROT_WRITE,
-		       MAP_SHARED, ctx->fd, 0);
-	if (ctx->mp == MAP_FAILED) {
+	mp = mmap(NULL, PAGE_SIZE + data_size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED, fd, 0);
+	if (mp == MAP_FAILED) {
 		perror("mmap");
+		close(fd);
 		return -1;
 	}
 
-	pebs_start(ctx);
-	return 0;
+	pthread_mutex_lock(&ctx->lock);
+	ctx->fd = fd;
+	ctx->rdlen = 0;
+	ctx->data_size = data_size;
+	ctx->mplen = PAGE_SIZE + data_size;
+	ctx->mp = mp;
+	pthread_mutex_unlock(&ctx->lock);
+
+	return pebs_start(ctx);
+}
+
+int
+pebs_init(struct pebs_context *ctx, pid_t pid, uint64_t sample_period)
+{
+	pthread_mutex_lock(&ctx->lock);
+	ctx->pid    = pid;
+	ctx->sample_period = sample_period;
+	ctx->min_period = sample_period;
+	ctx->idx = NULL;
+	pthread_mutex_unlock(&ctx->lock);
+
+	if (pebs_cpus != NULL) {
+		/* the samples of the thread come from the per-CPU buffers */
+		return 0;
+	}
+	return pebs_open(ctx, pid, -1, sample_period);
 }
 
+/*
+ * Set the regions of the samples. With the drain thread, the buffer is
+ * drained in the background from now on.
+ */
 int
-pebs_read(struct pebs_context *ctx, const int nreg, struct __region_info *reg_info, struct __pebs_elem *elem)
+pebs_set_regions(struct pebs_context *ctx, const struct __region_index *idx)
+{
+	struct epoll_event ev;
+	int r = 0;
+
+	pthread_mutex_lock(&ctx->lock);
+	ctx->idx = idx;
+	if (pebs_async && ctx->fd >= 0) {
+		ev.events = EPOLLIN;
+		ev.data.ptr = ctx;
+		if (epoll_ctl(pebs_epfd, EPOLL_CTL_ADD, ctx->fd, &ev) < 0) {
+			perror("epoll_ctl");
+			r = -1;
+		}
+	}
+	pthread_mutex_unlock(&ctx->lock);
+	return r;
+}
+
+/*
+ * Return the record of len bytes at the read position. A record wrapping
+ * around the end of the ring buffer is copied to buf.
+ */
+static void *
+pebs_record(struct pebs_context *ctx, char *dp, void *buf, size_t len)
+{
+	size_t off = ctx->rdlen & (ctx->data_size - 1);
+	size_t n;
+
+	if (off + len <= ctx->data_size) {
+		return dp + off;
+	}
+	n = ctx->data_size - off;
+	memcpy(buf, dp + off, n);
+	memcpy((char *)buf + n, dp, len - n);
+	return buf;
+}
+
+/* Samples parsed from a ring buffer, handed to a pebs_flush_t at once */
+struct pebs_batch {
+	int n;
+	uint32_t pid[PEBS_BATCH];
+	uint32_t tid[PEBS_BATCH];
+	uint64_t addr[PEBS_BATCH];
+	uint64_t phys_addr[PEBS_BATCH];
+	uint64_t value[PEBS_BATCH];
+};
+
+typedef void (*pebs_flush_t)(struct pebs_context *, struct pebs_batch *, void *);
+
+/*
+ * Parse the records in the ring buffer of ctx. Samples are passed to flush
+ * in batches, and the number of lost samples is added to lost.
+ */
+static int
+pebs_consume(struct pebs_context *ctx, pebs_flush_t flush, void *arg, uint64_t *lost_cnt)
 {
 	struct perf_event_mmap_page *mp = ctx->mp;
 
@@ -102,44 +323,55 @@ pebs_read(struct pebs_context *ctx, const int nreg, struct __region_info *reg_in
 		return -1;
 
 	int r = 0;
-	int i;
-	struct perf_event_header *header;
-	struct perf_sample *data;
+	struct perf_event_header hbuf, *header;
+	struct perf_sample sbuf, *data;
+	struct perf_lost lbuf, *lost;
+	struct perf_lost_samples lsbuf, *lost_samples;
+	struct pebs_batch batch;
 	uint64_t last_head;
 	char *dp = ((char *) mp) + PAGE_SIZE;
 
+	batch.n = 0;
 	do {
 		ctx->seq = mp->lock;
 		barrier();
 		last_head = mp->data_head;
+		barrier();
 
 		while ((uint64_t)ctx->rdlen < last_head) {
-			header = (struct perf_event_header *) (dp + ctx->rdlen % DATA_SIZE);
+			header = pebs_record(ctx, dp, &hbuf, sizeof(hbuf));
+			if (header->size == 0) {
+				/* broken record: skip all */
+				DEBUG_PRINT("size zero record\n");
+				ctx->rdlen = last_head;
+				r = -1;
+				break;
+			}
 
 			switch (header->type) {
 			case PERF_RECORD_LOST:
-				DEBUG_PRINT("received PERF_RECORD_LOST\n");
+				lost = pebs_record(ctx, dp, &lbuf, sizeof(lbuf));
+				*lost_cnt += lost->lost;
+				DEBUG_PRINT("received PERF_RECORD_LOST: lost:%lu\n", lost->lost);
 				break;
 			case PERF_RECORD_SAMPLE:
-				data = (struct perf_sample *) (dp + ctx->rdlen % DATA_SIZE);
-
 				if (header->size < sizeof(*data)) {
 					DEBUG_PRINT("size too small. size:%u\n", header->size);
 					r = -1;
-					continue;
+					break;
 				}
-				if (ctx->pid == data->pid) {
-					DEBUG_PRINT("pid:%u tid:%u time:%lu addr:%lx phys_addr:%lx llc_miss:%lu\n",
-						    data->pid, data->tid, data->time_enabled,
-						    data->addr, data->phys_addr, data->value);
-					for (i = 0; i < nreg; i++) {
-						if (reg_info[i].addr <= data->addr &&
-						    reg_info[i].addr + reg_info[i].size > data->addr) {
-							elem->sample[i]++;
-							DEBUG_PRINT("sample: region %d (%lu)\n", i, elem->sample[i]);
-							elem->llcmiss = data->value;
-						}
-					}
+				data = pebs_record(ctx, dp, &sbuf, sizeof(sbuf));
+				DEBUG_PRINT("pid:%u tid:%u time:%lu addr:%lx phys_addr:%lx llc_miss:%lu\n",
+					    data->pid, data->tid, data->time_enabled,
+					    data->addr, data->phys_addr, data->value);
+				batch.pid[batch.n] = data->pid;
+				batch.tid[batch.n] = data->tid;
+				batch.addr[batch.n] = data->addr;
+				batch.phys_addr[batch.n] = data->phys_addr;
+				batch.value[batch.n] = data->value;
+				if (++batch.n == PEBS_BATCH) {
+					flush(ctx, &batch, arg);
+					batch.n = 0;
 				}
 				break;
 			case PERF_RECORD_THROTTLE:
@@ -149,7 +381,9 @@ pebs_read(struct pebs_context *ctx, const int nreg, struct __region_info *reg_in
 				DEBUG_PRINT("received PERF_RECORD_UNTHROTTLE\n");
 				break;
 			case PERF_RECORD_LOST_SAMPLES:
-				DEBUG_PRINT("received PERF_RECORD_LOST_SAMPLES\n");
+				lost_samples = pebs_record(ctx, dp, &lsbuf, sizeof(lsbuf));
+				*lost_cnt += lost_samples->lost;
+				DEBUG_PRINT("received PERF_RECORD_LOST_SAMPLES: lost:%lu\n", lost_samples->lost);
 				break;
 			default:
 				DEBUG_PRINT("other data received. type:%d\n", header->type);
@@ -159,18 +393,419 @@ pebs_read(struct pebs_context *ctx, const int nreg, struct __region_info *reg_in
 			ctx->rdlen += header->size;
 		}
 
-		mp->data_tail = last_head;
+		mp->data_tail = ctx->rdlen;
 		barrier();
 	} while (mp->lock != ctx->seq);
+	if (batch.n > 0) {
+		flush(ctx, &batch, arg);
+	}
+
+	return r;
+}
+
+/*
+ * Count the batched samples of the thread of ctx in their regions. The
+ * counter value of the last sample in a region is kept.
+ */
+struct pebs_thread_sink {
+	const struct __region_index *idx;
+	struct __pebs_elem *elem;
+};
+
+static void
+pebs_flush_thread(struct pebs_context *ctx, struct pebs_batch *batch, void *arg)
+{
+	struct pebs_thread_sink *sink = arg;
+	struct __pebs_elem *elem = sink->elem;
+	int k, nhot = 0;
+	int regions[PEBS_BATCH];
+	uint32_t hot_pid[PEBS_BATCH];
+	uint64_t hot_addr[PEBS_BATCH];
+
+	classify_regions(sink->idx, sink->idx->phys ? batch->phys_addr : batch->addr, batch->n, regions);
+	for (k = 0; k < batch->n; k++) {
+		if (batch->tid[k] != ctx->pid) {
+			continue;
+		}
+		elem->nsamples++;
+		hot_pid[nhot] = batch->pid[k];
+		hot_addr[nhot++] = batch->addr[k];
+		if (regions[k] < 0) {
+			continue;
+		}
+		elem->sample[regions[k]]++;
+		elem->llcmiss = batch->value[k];
+		if (media_access(&ctx->media, sink->idx->phys ? batch->phys_addr[k] : batch->addr[k])) {
+			elem->media_hits++;
+		}
+		DEBUG_PRINT("sample: region %d (%lu)\n", regions[k], elem->sample[regions[k]]);
+	}
+	if (ctx->kind == PEBS_LOAD) {
+		heatmap_add(hot_pid, hot_addr, nhot);
+	}
+}
+
+int
+pebs_read(struct pebs_context *ctx, const struct __region_index *idx, struct __pebs_elem *elem)
+{
+	int i, r;
+	struct pebs_thread_sink sink = { .idx = idx, .elem = elem };
+
+	r = pebs_consume(ctx, pebs_flush_thread, &sink, &elem->lost);
 
 	elem->total = 0;
-	for (i = 0; i < nreg; i++) {
-		elem->total += elem->sample[i];
+	for (i = 0; i < idx->n; i++) {
+		elem->total += elem->sample[idx->region[i]];
 	}
 
 	return r;
 }
 
+/* Count a sample of the thread tid of ctx in the read of the per-CPU buffer. */
+static void
+pebs_add_share(struct pebs_context *ring, struct pebs_context *ctx, const uint32_t tid)
+{
+	struct pebs_share *shares;
+	int k, n;
+
+	/* samples of a thread come in runs */
+	for (k = ring->nshares - 1; k >= 0; k--) {
+		if (ring->shares[k].ctx == ctx && ring->shares[k].tid == tid) {
+			ring->shares[k].nsamples++;
+			return;
+		}
+	}
+	if (ring->nshares == ring->maxshares) {
+		n = (ring->maxshares > 0) ? ring->maxshares * 2 : 8;
+		shares = realloc(ring->shares, sizeof(struct pebs_share) * n);
+		if (shares == NULL) {
+			perror("realloc");
+			return;
+		}
+		ring->shares = shares;
+		ring->maxshares = n;
+	}
+	ring->shares[ring->nshares].ctx = ctx;
+	ring->shares[ring->nshares].tid = tid;
+	ring->shares[ring->nshares].nsamples = 1;
+	ring->nshares++;
+}
+
+/*
+ * Give the samples lost in a per-CPU buffer to the monitors whose samples
+ * are read with them, in proportion to their samples, as the lost samples
+ * of a per-thread buffer. Those of a read without any sample of the
+ * monitors are kept for the next read.
+ */
+static void
+pebs_share_lost(struct pebs_context *ring)
+{
+	struct pebs_context *ctx;
+	uint64_t n, total = 0, sum = 0, given = 0;
+	int k;
+
+	if (ring->lost_pending == 0) {
+		return;
+	}
+	for (k = 0; k < ring->nshares; k++) {
+		total += ring->shares[k].nsamples;
+	}
+	if (total == 0) {
+		return;
+	}
+	for (k = 0; k < ring->nshares; k++) {
+		sum += ring->shares[k].nsamples;
+		n = (k == ring->nshares - 1) ? ring->lost_pending - given :
+			(uint64_t)((double)ring->lost_pending * sum / total) - given;
+		given += n;
+		ctx = ring->shares[k].ctx;
+		pthread_mutex_lock(&ctx->lock);
+		if (ctx->idx != NULL && ctx->pid == ring->shares[k].tid) {
+			ctx->acc.lost += n;
+		}
+		pthread_mutex_unlock(&ctx->lock);
+		DEBUG_PRINT("lost: cpu %d tid %u (%lu)\n", ring->cpu, ring->shares[k].tid, n);
+	}
+	ring->lost_pending = 0;
+}
+
+/*
+ * Demultiplex the batched samples of a per-CPU buffer to the monitors by
+ * the tid. The LLC misses of a thread are estimated from the number of its
+ * samples, because the counter value in a sample is of the CPU core.
+ */
+static void
+pebs_flush_cpu(struct pebs_context *ring, struct pebs_batch *batch, void *arg)
+{
+	struct pebs_context *ctx = NULL;
+	int k, region, nhot = 0;
+	uint32_t hot_pid[PEBS_BATCH];
+	uint64_t hot_addr[PEBS_BATCH];
+
+	for (k = 0; k < batch->n; k++) {
+		if (k == 0 || batch->pid[k] != batch->pid[k - 1] || batch->tid[k] != batch->tid[k - 1]) {
+			ctx = pebs_lookup(batch->pid[k], batch->tid[k], ring->kind);
+		}
+		if (ctx == NULL) {
+			/* not monitored */
+			continue;
+		}
+		pthread_mutex_lock(&ctx->lock);
+		if (ctx->idx != NULL && ctx->pid == batch->tid[k]) {
+			ctx->acc.llcmiss += ring->sample_period;
+			ctx->acc.nsamples++;
+			pebs_add_share(ring, ctx, batch->tid[k]);
+			hot_pid[nhot] = batch->pid[k];
+			hot_addr[nhot++] = batch->addr[k];
+			region = lookup_region(ctx->idx, ctx->idx->phys ? batch->phys_addr[k] : batch->addr[k]);
+			if (region >= 0) {
+				ctx->acc.sample[region]++;
+				ctx->acc.total++;
+				if (media_access(&ctx->media, ctx->idx->phys ? batch->phys_addr[k] : batch->addr[k])) {
+					ctx->acc.media_hits++;
+				}
+				DEBUG_PRINT("sample: tid %u region %d (%lu)\n", batch->tid[k], region, ctx->acc.sample[region]);
+			}
+		}
+		pthread_mutex_unlock(&ctx->lock);
+	}
+	if (ring->kind == PEBS_LOAD) {
+		heatmap_add(hot_pid, hot_addr, nhot);
+	}
+}
+
+static void
+pebs_read_cpu(struct pebs_context *ring)
+{
+	uint64_t lost = ring->acc.lost;
+
+	ring->nshares = 0;
+	if (pebs_consume(ring, pebs_flush_cpu, NULL, &ring->acc.lost) < 0) {
+		DEBUG_PRINT("failed to read the PEBS buffer of cpu %d\n", ring->cpu);
+	}
+	ring->lost_pending += ring->acc.lost - lost;
+	pebs_share_lost(ring);
+}
+
+/*
+ * Read the per-CPU buffers divided into nparts. They are read at every
+ * epoch even with the drain thread, which is woken up only when a quarter
+ * of a buffer is filled, so that the samples of the epoch are all counted.
+ */
+void
+pebs_drain_cpus(const int part, const int nparts)
+{
+	int i;
+
+	if (pebs_cpus == NULL) {
+		return;
+	}
+	for (i = part; i < pebs_nrings; i += nparts) {
+		pthread_mutex_lock(&pebs_cpus[i].lock);
+		pebs_read_cpu(&pebs_cpus[i]);
+		pthread_mutex_unlock(&pebs_cpus[i].lock);
+	}
+}
+
+/*
+ * Open a PEBS event and a buffer for each CPU core in cpuset, instead of one
+ * per thread. lookup returns the context of the monitor of a sample.
+ */
+int
+pebs_start_percpu(cpu_set_t *cpuset, const uint64_t sample_period, pebs_lookup_t lookup)
+{
+	int cpu, i = 0;
+	struct epoll_event ev;
+
+	int nrings = CPU_COUNT(cpuset) * (pebs_stores ? 2 : 1);
+
+	pebs_cpus = calloc(sizeof(struct pebs_context), nrings);
+	if (pebs_cpus == NULL) {
+		perror("calloc");
+		return -1;
+	}
+	pebs_lookup = lookup;
+	/* loads of all the CPU cores first, and then stores */
+	for (cpu = 0; i < nrings; cpu = (cpu + 1) % CPU_SETSIZE) {
+		if (!CPU_ISSET(cpu, cpuset)) {
+			continue;
+		}
+		struct pebs_context *ring = &pebs_cpus[i];
+		ring->fd = -1;
+		ring->mp = MAP_FAILED;
+		ring->pid = -1;
+		ring->cpu = cpu;
+		ring->kind = (i < CPU_COUNT(cpuset)) ? PEBS_LOAD : PEBS_STORE;
+		ring->sample_period = sample_period;
+		i++;
+		pthread_mutex_init(&ring->lock, NULL);
+		pebs_nrings = i;
+		if (pebs_open(ring, -1, cpu, sample_period) < 0) {
+			fprintf(stderr, "%s pebs_open failed. cpu:%d\n", __func__, cpu);
+			return -1;
+		}
+		if (pebs_async) {
+			ev.events = EPOLLIN;
+			ev.data.ptr = ring;
+			if (epoll_ctl(pebs_epfd, EPOLL_CTL_ADD, ring->fd, &ev) < 0) {
+				perror("epoll_ctl");
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+void
+pebs_stop_percpu(void)
+{
+	int i;
+
+	for (i = 0; i < pebs_nrings; i++) {
+		if (pebs_cpus[i].acc.lost > 0) {
+			printf("PEBS lost %s samples on cpu %d =%lu\n", (pebs_cpus[i].kind == PEBS_STORE) ? "store" : "load",
+			       pebs_cpus[i].cpu, pebs_cpus[i].acc.lost);
+		}
+		pebs_fini(&pebs_cpus[i]);
+		free(pebs_cpus[i].shares);
+		pthread_mutex_destroy(&pebs_cpus[i].lock);
+	}
+	free(pebs_cpus);
+	pebs_cpus = NULL;
+	pebs_nrings = 0;
+}
+
+/*
+ * Get the samples of the monitor. Without the drain thread, the buffer is
+ * read here. Otherwise, the samples already drained are copied, after the
+ * rest of the buffer is drained: the drain thread is woken up only when a
+ * quarter of the buffer is filled, which a thread sampled at a low rate may
+ * not reach in an epoch. The per-CPU buffers are drained by
+ * pebs_drain_cpus() before.
+ */
+int
+pebs_collect(struct pebs_context *ctx, const struct __region_index *idx, struct __pebs_elem *elem)
+{
+	int i;
+
+	if (!pebs_async && pebs_cpus == NULL) {
+		return pebs_read(ctx, idx, elem);
+	}
+	pthread_mutex_lock(&ctx->lock);
+	if (pebs_cpus == NULL && ctx->fd >= 0 && ctx->idx != NULL) {
+		if (pebs_read(ctx, ctx->idx, &ctx->acc) < 0) {
+			DEBUG_PRINT("pebs_read failed. pid:%d\n", ctx->pid);
+		}
+		if (ctx->mp != MAP_FAILED && ctx->mp->data_head != ctx->rdlen) {
+			/* the thread is stopped: the samples of the epoch must be all read */
+			fprintf(stderr, "%s samples left in the buffer. pid:%d\n", __func__, ctx->pid);
+		}
+	}
+	for (i = 0; i < idx->n; i++) {
+		elem->sample[idx->region[i]] = ctx->acc.sample[idx->region[i]];
+	}
+	elem->total   = ctx->acc.total;
+	elem->llcmiss = ctx->acc.llcmiss;
+	elem->lost    = ctx->acc.lost;
+	elem->nsamples = ctx->acc.nsamples;
+	elem->media_hits = ctx->acc.media_hits;
+	pthread_mutex_unlock(&ctx->lock);
+	return 0;
+}
+
+static void *
+pebs_drain_main(void *arg)
+{
+	struct epoll_event evs[PEBS_DRAIN_EVENTS];
+	struct pebs_context *ctx;
+	int i, n;
+
+	while (1) {
+		n = epoll_wait(pebs_epfd, evs, PEBS_DRAIN_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("epoll_wait");
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			ctx = evs[i].data.ptr;
+			if (ctx == NULL) {
+				/* pebs_stop_drain() */
+				return NULL;
+			}
+			pthread_mutex_lock(&ctx->lock);
+			if (ctx->cpu >= 0) {
+				pebs_read_cpu(ctx);
+			} else if (ctx->fd >= 0 && ctx->idx != NULL) {
+				if (pebs_read(ctx, ctx->idx, &ctx->acc) < 0) {
+					DEBUG_PRINT("pebs_read failed. pid:%d\n", ctx->pid);
+				}
+				if (evs[i].events & EPOLLHUP) {
+					/* the thread exited: no more samples */
+					epoll_ctl(pebs_epfd, EPOLL_CTL_DEL, ctx->fd, NULL);
+				}
+			}
+			pthread_mutex_unlock(&ctx->lock);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Start the thread draining the PEBS buffers of all the monitors in the
+ * background, so that the epoch loop does not parse samples while the
+ * target threads are stopped. It must be called before any pebs_init().
+ */
+int
+pebs_start_drain(void)
+{
+	struct epoll_event ev;
+
+	pebs_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (pebs_epfd < 0) {
+		perror("epoll_create1");
+		return -1;
+	}
+	pebs_evfd = eventfd(0, EFD_CLOEXEC);
+	if (pebs_evfd < 0) {
+		perror("eventfd");
+		return -1;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(pebs_epfd, EPOLL_CTL_ADD, pebs_evfd, &ev) < 0) {
+		perror("epoll_ctl");
+		return -1;
+	}
+	if (pthread_create(&pebs_drain_thread, NULL, pebs_drain_main, NULL) != 0) {
+		fprintf(stderr, "%s pthread_create failed\n", __func__);
+		return -1;
+	}
+	pebs_async = true;
+	return 0;
+}
+
+void
+pebs_stop_drain(void)
+{
+	uint64_t one = 1;
+
+	if (!pebs_async) {
+		return;
+	}
+	if (write(pebs_evfd, &one, sizeof(one)) != sizeof(one)) {
+		perror("write");
+	}
+	pthread_join(pebs_drain_thread, NULL);
+	close(pebs_evfd);
+	close(pebs_epfd);
+	pebs_evfd = -1;
+	pebs_epfd = -1;
+	pebs_async = false;
+}
+
 int
 pebs_start(struct pebs_context *ctx)
 {
@@ -198,14 +833,73 @@ pebs_stop(struct pebs_context *ctx)
 	return 0;
 }
 
+/*
+ * Retune the period of a thread so that about pebs_target samples are
+ * taken in the next epoch, given the samples (including the lost ones) of
+ * this epoch. The period given to pebs_init() is the lower bound, which
+ * caps the overhead of the sampling. A period changes by 4 times at most in
+ * an epoch, and a small change is not applied. The per-CPU buffers are
+ * shared by threads and are not retuned.
+ */
+int
+pebs_adapt(struct pebs_context *ctx, const uint64_t nsamples)
+{
+	uint64_t period;
+	int r = 0;
+
+	if (pebs_target == 0 || pebs_cpus != NULL) {
+		return 0;
+	}
+
+	period = ctx->sample_period;
+	if (nsamples == 0) {
+		period /= 4;
+	} else {
+		period = (double)period * nsamples / pebs_target;
+		if (period > ctx->sample_period * 4) {
+			period = ctx->sample_period * 4;
+		} else if (period < ctx->sample_period / 4) {
+			period = ctx->sample_period / 4;
+		}
+	}
+	if (period < ctx->min_period) {
+		period = ctx->min_period;
+	} else if (period > PEBS_MAX_PERIOD) {
+		period = PEBS_MAX_PERIOD;
+	}
+	if (period == ctx->sample_period ||
+	    (period > ctx->sample_period * 7 / 8 && period < ctx->sample_period * 9 / 8)) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	if (ctx->fd >= 0) {
+		if (ioctl(ctx->fd, PERF_EVENT_IOC_PERIOD, &period) < 0) {
+			perror("ioctl");
+			r = -1;
+		} else {
+			ctx->sample_period = period;
+		}
+	}
+	pthread_mutex_unlock(&ctx->lock);
+	return r;
+}
+
 int
 pebs_fini(struct pebs_context *ctx)
 {
 	pebs_stop(ctx);
 
+	pthread_mutex_lock(&ctx->lock);
+	ctx->idx = NULL;
 	if (ctx->fd < 0) {
+		pthread_mutex_unlock(&ctx->lock);
 		return 0;
 	}
+	if (pebs_async) {
+		/* the fd might be already removed */
+		epoll_ctl(pebs_epfd, EPOLL_CTL_DEL, ctx->fd, NULL);
+	}
 
 	if (ctx->mp != MAP_FAILED) {
 		munmap(ctx->mp, ctx->mplen);
@@ -219,5 +913,6 @@ pebs_fini(struct pebs_context *ctx)
 	}
 
 	ctx->pid = -1;
+	pthread_mutex_unlock(&ctx->lock);
 	return 0;
 }
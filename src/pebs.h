@@ -7,21 +7,72 @@
 #ifndef __PEBS_H
 #define __PEBS_H
 #include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
 #include "common.h"
 #include "types.h"
+#include "region.h"
+#include "media.h"
+
+/* the event sampled by a context */
+enum pebs_kind {
+	PEBS_LOAD = 0,		/* mem_load_retired.l3_miss */
+	PEBS_STORE = 1,		/* mem_inst_retired.all_stores */
+};
+
+/* the samples of a monitor in a read of a per-CPU buffer */
+struct pebs_share {
+	struct pebs_context *ctx;
+	uint32_t      tid;
+	uint64_t      nsamples;
+};
 
 struct pebs_context {
 	int           fd;
 	int           pid;
+	int           cpu;		/* >= 0 for a per-CPU buffer */
+	enum pebs_kind kind;
 	uint64_t      sample_period;
+	uint64_t      min_period;	/* the lower bound of pebs_adapt() */
 	uint32_t      seq;
 	size_t        rdlen;
 	size_t        mplen;
+	size_t        data_size;
 	struct perf_event_mmap_page *mp;
+	/* used by the drain thread */
+	pthread_mutex_t lock;
+	const struct __region_index *idx;
+	struct __pebs_elem acc;	/* samples drained so far */
+	struct __media_buffer media;	/* fed with the samples in the regions */
+	/* of a per-CPU buffer, see pebs_share_lost() */
+	struct pebs_share *shares;
+	int           nshares;
+	int           maxshares;
+	uint64_t      lost_pending;
 };
 
+#define PEBS_DEFAULT_PAGES 8
+#define PEBS_MAX_PERIOD 1000000
+
+int pebs_set_data_pages(const int);
+void pebs_enable_stores(void);
+bool pebs_stores_enabled(void);
+void pebs_set_target(const uint64_t);
+int pebs_setup(struct pebs_context *, const int, const enum pebs_kind);
+void pebs_reset(struct pebs_context *, const int);
+void pebs_cleanup(struct pebs_context *);
 int pebs_init(struct pebs_context *, pid_t, uint64_t);
-int pebs_read(struct pebs_context *, const int,  struct __region_info *, struct __pebs_elem *);
+int pebs_set_regions(struct pebs_context *, const struct __region_index *);
+int pebs_read(struct pebs_context *, const struct __region_index *, struct __pebs_elem *);
+int pebs_collect(struct pebs_context *, const struct __region_index *, struct __pebs_elem *);
+int pebs_adapt(struct pebs_context *, const uint64_t);
+typedef struct pebs_context *(*pebs_lookup_t)(uint32_t, uint32_t, enum pebs_kind);
+
+int pebs_start_percpu(cpu_set_t *, const uint64_t, pebs_lookup_t);
+void pebs_stop_percpu(void);
+void pebs_drain_cpus(const int, const int);
+int pebs_start_drain(void);
+void pebs_stop_drain(void);
 int pebs_start(struct pebs_context *);
 int pebs_stop(struct pebs_context *);
 int pebs_fini(struct pebs_context *);
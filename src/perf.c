@@ -11,6 +11,7 @@
 #include <unistd.h>
 #include <linux/perf_event.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <time.h>
@@ -23,8 +24,12 @@ static long perf_event_open(struct perf_event_attr* event_attr, pid_t pid,
                    cpu, group_fd, flags);
 }
 
+/* The CPU core which the calling thread is pinned to, or -1. */
+static __thread int pinned_cpu = -1;
+
 int perf_init(struct __perf_info *ctx)
 {
+    ctx->mp = NULL;
     ctx->fd = perf_event_open(&ctx->attr, ctx->pid, ctx->cpu, ctx->group_fd, ctx->flags);
     if (ctx->fd == -1) {
         perror("perf_event_open");
@@ -36,6 +41,86 @@ int perf_init(struct __perf_info *ctx)
     return 0;
 }
 
+/*
+ * Map the first page of the event to read the counter with rdpmc in
+ * userspace. It fails if the kernel does not allow rdpmc for the event.
+ */
+int perf_mmap(struct __perf_info *ctx)
+{
+    void *mp;
+
+    mp = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, ctx->fd, 0);
+    if (mp == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    ctx->mp = (struct perf_event_mmap_page *)mp;
+    if (!ctx->mp->cap_user_rdpmc) {
+        munmap(mp, sysconf(_SC_PAGESIZE));
+        ctx->mp = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * A counter of a per-CPU event can be read with rdpmc only on the CPU core.
+ * A thread pinned to a core tells it, because sched_getcpu() cannot exclude
+ * a migration just after the call.
+ */
+void perf_set_pinned_cpu(const int cpu)
+{
+    pinned_cpu = cpu;
+}
+
+bool perf_can_rdpmc(struct __perf_info *ctx)
+{
+    return ctx->mp != NULL && ctx->cpu >= 0 && ctx->cpu == pinned_cpu;
+}
+
+static inline uint64_t rdpmc(const uint32_t counter)
+{
+    uint32_t low, high;
+
+    __asm__ __volatile__("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+    return low | ((uint64_t)high << 32);
+}
+
+#define compiler_barrier() __asm__ __volatile__("" ::: "memory")
+
+/*
+ * Read the counter with rdpmc, following the protocol described in
+ * linux/perf_event.h. It falls back to read() if it is not possible.
+ */
+ssize_t perf_read_rdpmc(struct __perf_info *ctx, uint64_t *value)
+{
+    struct perf_event_mmap_page *pc = ctx->mp;
+    uint32_t seq, idx;
+    uint64_t count;
+    int64_t pmc;
+
+    if (!perf_can_rdpmc(ctx)) {
+        return perf_read_pmu(ctx, value);
+    }
+
+    do {
+        seq = pc->lock;
+        compiler_barrier();
+        idx = pc->index;
+        count = pc->offset;
+        if (pc->cap_user_rdpmc && idx) {
+            pmc = rdpmc(idx - 1);
+            pmc <<= 64 - pc->pmc_width;
+            pmc >>= 64 - pc->pmc_width;
+            count += pmc;
+        }
+        compiler_barrier();
+    } while (pc->lock != seq);
+
+    *value = count;
+    return sizeof(*value);
+}
+
 ssize_t perf_read_pmu(struct __perf_info *ctx, uint64_t *value)
 {
     /*
@@ -52,6 +137,109 @@ ssize_t perf_read_pmu(struct __perf_info *ctx, uint64_t *value)
     return r;
 }
 
+/*
+ * Read the count of an event opened with PERF_FORMAT_TOTAL_TIME_ENABLED and
+ * PERF_FORMAT_TOTAL_TIME_RUNNING, with the times in nsec.
+ */
+ssize_t perf_read_pmu_times(struct __perf_info *ctx, uint64_t *value, uint64_t *enabled, uint64_t *running)
+{
+    uint64_t buf[3];
+
+    /* Workaround: see perf_read_pmu() */
+    struct timespec zero = {0};
+    nanosleep(&zero, NULL);
+    ssize_t r = read(ctx->fd, buf, sizeof(buf));
+    if (r < 0) {
+        perror("read");
+        return r;
+    }
+    if (r != sizeof(buf)) {
+        fprintf(stderr, "%s unexpected size. size:%zd\n", __func__, r);
+        return -1;
+    }
+    *value = buf[0];
+    *enabled = buf[1];
+    *running = buf[2];
+    return r;
+}
+
+/* Read a group, with the times enabled and running if times is not NULL. */
+static ssize_t read_group(struct __perf_info *ctx, uint64_t *values, const int n, uint64_t *times)
+{
+    const int ntimes = (times != NULL) ? 2 : 0;
+    uint64_t buf[1 + ntimes + n];
+
+    /* Workaround: see perf_read_pmu() */
+    struct timespec zero = {0};
+    nanosleep(&zero, NULL);
+    ssize_t r = read(ctx->fd, buf, sizeof(buf));
+    if (r < 0) {
+        perror("read");
+        return r;
+    }
+    if (r != sizeof(buf) || buf[0] != n) {
+        fprintf(stderr, "%s unexpected group size. size:%zd\n", __func__, r);
+        return -1;
+    }
+    if (times != NULL) {
+        memcpy(times, &buf[1], sizeof(uint64_t) * ntimes);
+    }
+    memcpy(values, &buf[1 + ntimes], sizeof(uint64_t) * n);
+    return r;
+}
+
+/*
+ * Read all the n events of the group led by ctx in a single read(), which
+ * is opened with PERF_FORMAT_GROUP. The values are stored in the order of
+ * the creation of the events.
+ */
+ssize_t perf_read_group(struct __perf_info *ctx, uint64_t *values, const int n)
+{
+    return read_group(ctx, values, n, NULL);
+}
+
+/*
+ * perf_read_group() of a group opened also with PERF_FORMAT_TOTAL_TIME_ENABLED
+ * and PERF_FORMAT_TOTAL_TIME_RUNNING. The times are of the group.
+ */
+ssize_t perf_read_group_times(struct __perf_info *ctx, uint64_t *values, const int n, uint64_t *enabled, uint64_t *running)
+{
+    uint64_t times[2];
+    ssize_t r;
+
+    r = read_group(ctx, values, n, times);
+    if (r < 0) {
+        return r;
+    }
+    *enabled = times[0];
+    *running = times[1];
+    return r;
+}
+
+/*
+ * Scale the count of an event time-multiplexed with other events by the
+ * kernel. The count since the last call is scaled by the time enabled over
+ * the time running in the same interval, and value is replaced with the
+ * sum of the scaled counts. An interval in which the event did not run at
+ * all adds nothing. Return true if the event did not run all the time.
+ */
+bool perf_scale(struct __perf_info *ctx, uint64_t *value, const uint64_t enabled, const uint64_t running)
+{
+    uint64_t count = *value - ctx->scale.raw;
+    uint64_t d_enabled = enabled - ctx->scale.enabled;
+    uint64_t d_running = running - ctx->scale.running;
+
+    if (d_running < d_enabled) {
+        count = (d_running > 0) ? (uint64_t)((double)count * d_enabled / d_running) : 0;
+    }
+    ctx->scale.raw = *value;
+    ctx->scale.enabled = enabled;
+    ctx->scale.running = running;
+    ctx->scale.scaled += count;
+    *value = ctx->scale.scaled;
+    return d_running < d_enabled;
+}
+
 int perf_start(struct __perf_info *ctx)
 {
     if (ioctl(ctx->fd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
@@ -73,6 +261,10 @@ int perf_stop(struct __perf_info *ctx)
 
 void perf_fini(struct __perf_info *ctx)
 {
+    if (ctx->mp != NULL) {
+        munmap(ctx->mp, sysconf(_SC_PAGESIZE));
+        ctx->mp = NULL;
+    }
     if (ctx->fd != -1) {
         close(ctx->fd);
         ctx->fd = -1;
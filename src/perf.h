@@ -10,7 +10,15 @@
 #include "types.h"
 
 int perf_init(struct __perf_info *ctx);
+int perf_mmap(struct __perf_info *ctx);
+void perf_set_pinned_cpu(const int cpu);
+bool perf_can_rdpmc(struct __perf_info *ctx);
 ssize_t perf_read_pmu(struct __perf_info *ctx, uint64_t *value);
+ssize_t perf_read_rdpmc(struct __perf_info *ctx, uint64_t *value);
+ssize_t perf_read_group(struct __perf_info *ctx, uint64_t *values, const int n);
+ssize_t perf_read_pmu_times(struct __perf_info *ctx, uint64_t *value, uint64_t *enabled, uint64_t *running);
+ssize_t perf_read_group_times(struct __perf_info *ctx, uint64_t *values, const int n, uint64_t *enabled, uint64_t *running);
+bool perf_scale(struct __perf_info *ctx, uint64_t *value, const uint64_t enabled, const uint64_t running);
 int perf_start(struct __perf_info *ctx);
 int perf_stop(struct __perf_info *ctx);
 void perf_fini(struct __perf_info *ctx);
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+#include <stdio.h>
+#include <stdlib.h>
+#include "region.h"
+#include "common.h"
+
+int init_region_index(struct __region_index *idx, const int nmem)
+{
+    idx->n = 0;
+    idx->phys = false;
+    idx->start = (uint64_t *)calloc(sizeof(uint64_t), nmem);
+    idx->end = (uint64_t *)calloc(sizeof(uint64_t), nmem);
+    idx->region = (int *)calloc(sizeof(int), nmem);
+    if (idx->start == NULL || idx->end == NULL || idx->region == NULL) {
+        fprintf(stderr, "%s calloc failed.\n", __func__);
+        return -1;
+    }
+    return 0;
+}
+
+void fini_region_index(struct __region_index *idx)
+{
+    free(idx->start);
+    free(idx->end);
+    free(idx->region);
+    idx->start = NULL;
+    idx->end = NULL;
+    idx->region = NULL;
+    idx->n = 0;
+}
+
+void clear_region_index(struct __region_index *idx)
+{
+    idx->n = 0;
+    idx->phys = false;
+}
+
+/*
+ * Build the index of nreg regions. Empty regions are ignored. It returns -1
+ * if the regions overlap.
+ */
+int build_region_index(struct __region_index *idx, const int nreg, const struct __region_info *ri)
+{
+    int i, j;
+
+    idx->n = 0;
+    for (i = 0; i < nreg; i++) {
+        if (ri[i].size == 0) {
+            continue;
+        }
+        /* insertion sort: the number of regions is small */
+        for (j = idx->n; j > 0 && idx->start[j - 1] > ri[i].addr; j--) {
+            idx->start[j] = idx->start[j - 1];
+            idx->end[j] = idx->end[j - 1];
+            idx->region[j] = idx->region[j - 1];
+        }
+        idx->start[j] = ri[i].addr;
+        idx->end[j] = ri[i].addr + ri[i].size;
+        idx->region[j] = i;
+        idx->n++;
+    }
+    for (i = 1; i < idx->n; i++) {
+        if (idx->start[i] < idx->end[i - 1]) {
+            fprintf(stderr, "%s region %d overlaps region %d.\n", __func__, idx->region[i], idx->region[i - 1]);
+            idx->n = 0;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Return the region including addr, or -1. */
+int lookup_region(const struct __region_index *idx, const uint64_t addr)
+{
+    int lo = 0, hi = idx->n;
+
+    /* find the first region starting after addr */
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (idx->start[mid] <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0 || addr >= idx->end[lo - 1]) {
+        return -1;
+    }
+    return idx->region[lo - 1];
+}
+
+/* Classify n addresses at once. regions[k] is the region of addrs[k], or -1. */
+void classify_regions(const struct __region_index *idx, const uint64_t *addrs, const int n, int *regions)
+{
+    int k;
+
+    for (k = 0; k < n; k++) {
+        regions[k] = lookup_region(idx, addrs[k]);
+    }
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#ifndef __REGION_H
+#define __REGION_H
+#include "types.h"
+
+/*
+ * Memory regions of a monitor sorted by the start address. The regions must
+ * not overlap, so that an address belongs to one region at most.
+ */
+struct __region_index {
+    int n;
+    bool phys;              /* the ranges are of physical addresses */
+    uint64_t *start;
+    uint64_t *end;          /* exclusive */
+    int *region;            /* the index in the region information */
+};
+
+int init_region_index(struct __region_index *, const int);
+void fini_region_index(struct __region_index *);
+int build_region_index(struct __region_index *, const int, const struct __region_info *);
+void clear_region_index(struct __region_index *);
+int lookup_region(const struct __region_index *, const uint64_t);
+void classify_regions(const struct __region_index *, const uint64_t *, const int, int *);
+#endif
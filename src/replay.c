@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "common.h"
+#include "emul.h"
+#include "trace.h"
+#include "media.h"
+#include "replay.h"
+
+/*
+ * A thread in a trace. Only the fields of struct __monitor used by the
+ * models are set.
+ */
+struct __replay_mon {
+    struct __monitor mon;
+    uint64_t epochs;
+    double epoch_time;      /* the sum of the epochs in sec */
+};
+
+static struct {
+    int n;
+    int max;
+    int nmem;
+    struct __replay_mon *mons;
+} replay;
+
+static void init_replay_elem(struct __elem *elem, const int nmem)
+{
+    memset(elem, 0, sizeof(*elem));
+    elem->pebs.sample = (uint64_t *)calloc(sizeof(uint64_t), nmem);
+    elem->store.sample = (uint64_t *)calloc(sizeof(uint64_t), nmem);
+    if (elem->pebs.sample == NULL || elem->store.sample == NULL) {
+        handle_error("calloc");
+    }
+}
+
+static void fini_replay_elem(struct __elem *elem)
+{
+    free(elem->pebs.sample);
+    free(elem->store.sample);
+}
+
+/* The thread of the record, added at its first record. */
+static struct __replay_mon *lookup_replay_mon(const uint32_t tgid, const uint32_t tid)
+{
+    struct __replay_mon *rm;
+    int k;
+
+    for (k = 0; k < replay.n; k++) {
+        if (replay.mons[k].mon.tgid == tgid && replay.mons[k].mon.tid == tid) {
+            return &replay.mons[k];
+        }
+    }
+    if (replay.n == replay.max) {
+        replay.max = replay.max ? replay.max * 2 : 64;
+        replay.mons = (struct __replay_mon *)realloc(replay.mons, sizeof(struct __replay_mon) * replay.max);
+        if (replay.mons == NULL) {
+            handle_error("realloc");
+        }
+    }
+    rm = &replay.mons[replay.n++];
+    memset(rm, 0, sizeof(*rm));
+    rm->mon.tgid = tgid;
+    rm->mon.tid = tid;
+    init_replay_elem(&rm->mon.elem[0], replay.nmem);
+    init_replay_elem(&rm->mon.elem[1], replay.nmem);
+    rm->mon.pebs_prop = (double *)calloc(sizeof(double), replay.nmem);
+    if (rm->mon.pebs_prop == NULL) {
+        handle_error("calloc");
+    }
+    return rm;
+}
+
+static void fini_replay_mons(void)
+{
+    int k;
+
+    for (k = 0; k < replay.n; k++) {
+        fini_replay_elem(&replay.mons[k].mon.elem[0]);
+        fini_replay_elem(&replay.mons[k].mon.elem[1]);
+        free(replay.mons[k].mon.pebs_prop);
+    }
+    free(replay.mons);
+}
+
+/*
+ * Set the monitor as if the counters started from 0 in the epoch, so that
+ * after - before is the record.
+ */
+static void load_record(struct __monitor *mon, const struct __trace_record *rec, const struct __trace_region *regions,
+                        struct __model_input *in)
+{
+    struct __pebs_elem *pa = &mon->elem[1].pebs, *sa = &mon->elem[1].store;
+    int j;
+
+    mon->before = &mon->elem[0];
+    mon->after = &mon->elem[1];
+    mon->num_of_region = rec->nregions;
+    mon->region_index.phys = (rec->flags & TRACE_PHYS) != 0;
+    for (j = 0; j < replay.nmem; j++) {
+        mon->elem[0].pebs.sample[j] = 0;
+        mon->elem[0].store.sample[j] = 0;
+        pa->sample[j] = (j < rec->nregions) ? regions[j].pebs_sample : 0;
+        sa->sample[j] = (j < rec->nregions) ? regions[j].store_sample : 0;
+    }
+    mon->elem[0].pebs.total = mon->elem[0].pebs.llcmiss = mon->elem[0].pebs.lost = 0;
+    mon->elem[0].pebs.nsamples = mon->elem[0].pebs.media_hits = 0;
+    mon->elem[0].store.total = mon->elem[0].store.llcmiss = mon->elem[0].store.lost = 0;
+    mon->elem[0].store.nsamples = mon->elem[0].store.media_hits = 0;
+    pa->total = rec->pebs_total;
+    pa->llcmiss = rec->pebs_llcmiss;
+    pa->lost = rec->pebs_lost;
+    pa->nsamples = rec->pebs_nsamples;
+    pa->media_hits = rec->pebs_media_hits;
+    sa->total = rec->store_total;
+    sa->lost = rec->store_lost;
+    sa->nsamples = rec->store_nsamples;
+    sa->media_hits = 0;
+
+    in->wb_cnt = rec->wb_cnt;
+    in->cpus_dram_rds = rec->cpus_dram_rds;
+    in->l2stall = rec->l2stall;
+    in->llchits = rec->llchits;
+    in->llcmiss = rec->llcmiss;
+    in->llcrmiss = rec->llcrmiss;
+    in->imc_rd = rec->imc_rd;
+    in->imc_wr = rec->imc_wr;
+    in->epoch_nsec = rec->epoch_nsec;
+    in->offcore_occ = rec->offcore_occ;
+    in->offcore_cyc = rec->offcore_cyc;
+}
+
+static void replay_usage(void)
+{
+    printf("Usage: mes replay [ -f ${CPU_FREQUENCY} ] [ -l ${LATENCY} ] [ -w ${WEIGHT} ] [ -B ${READ_GBPS},${WRITE_GBPS} [ -B ...] ] [ -q ${OCCUPANCY},${FACTOR} [ -q ...] ] [ -v ] ${TRACE_PATH} ${ALPHA_RD_LAT_NS} ${ALPHAWR_LAT_NS} [ ${BETA_RD_LAT_NS} ${BETA_WR_LAT_NS} [...] ]\n");
+}
+
+/*
+ * "mes replay": run the latency models over a trace recorded with -O, with
+ * the latencies and the options given here. argv[0] is "replay".
+ */
+int replay_main(int argc, char *argv[])
+{
+    struct __trace_reader reader;
+    struct __trace_record rec;
+    struct __trace_region *regions;
+    struct emul_nvm_bandwidth bw_limits[128];
+    int nbw = 0;
+    double cpu_freq = 0, dram_latency = 0, weight = -1;
+    bool verbose = false;
+    bool usage = false;
+    uint64_t nrecords = 0;
+    int opt, i, j, r;
+
+    struct option longopts[] = {
+        { "cpufreq",    required_argument, NULL, 'f' },
+        { "latency",    required_argument, NULL, 'l' },
+        { "weight",     required_argument, NULL, 'w' },
+        { "bandwidth",  required_argument, NULL, 'B' },
+        { "loadcurve",  required_argument, NULL, 'q' },
+        { "verbose",    no_argument,       NULL, 'v' },
+        { 0,        0,                 0,     0  },
+    };
+    while ((opt = getopt_long(argc, argv, "f:l:w:B:q:v", longopts, NULL)) != -1) {
+        char *end;
+        double occupancy, factor;
+
+        switch (opt) {
+            case 'f':
+                cpu_freq = (double)strtod(optarg, NULL);
+                if (cpu_freq <= 0) {
+                    usage = true;
+                }
+                break;
+            case 'l':
+                dram_latency = (double)strtod(optarg, NULL);
+                if (dram_latency <= 0) {
+                    usage = true;
+                }
+                break;
+            case 'w':
+                weight = (double)strtod(optarg, NULL);
+                if (weight < 0) {
+                    usage = true;
+                }
+                break;
+            case 'B':
+                if (nbw == 128) {
+                    usage = true;
+                    break;
+                }
+                bw_limits[nbw].read = (double)strtod(optarg, &end);
+                if (*end != ',') {
+                    usage = true;
+                    break;
+                }
+                bw_limits[nbw].write = (double)strtod(end + 1, &end);
+                if (*end != '\0' || bw_limits[nbw].read < 0 || bw_limits[nbw].write < 0) {
+                    usage = true;
+                    break;
+                }
+                nbw++;
+                break;
+            case 'q':
+                occupancy = (double)strtod(optarg, &end);
+                if (*end != ',') {
+                    usage = true;
+                    break;
+                }
+                factor = (double)strtod(end + 1, &end);
+                if (*end != '\0' || model_add_load_point(occupancy, factor) < 0) {
+                    usage = true;
+                }
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage = true;
+        }
+    }
+    i = argc - optind;
+    if (usage || i < 3 || (i % 2) == 0) {
+        replay_usage();
+        return 0;
+    }
+
+    if (open_trace(&reader, argv[optind++]) < 0) {
+        exit_with_message("Failed to open the trace\n");
+    }
+    /* the parameters of the host are of the recording unless given */
+    struct __emul emul = {
+        .cpu_freq = cpu_freq > 0 ? cpu_freq : reader.header.cpu_freq,
+        .weight = weight >= 0 ? weight : reader.header.weight,
+        .dram_latency = dram_latency > 0 ? dram_latency : reader.header.dram_latency,
+        .remote_latency = reader.header.remote_latency,
+    };
+    if (reader.header.flags & TRACE_STORES) {
+        pebs_enable_stores();
+    }
+    if (reader.header.flags & TRACE_MEDIA) {
+        /* the buffer is not simulated; the hits of the recording are used */
+        media_set_lines(1);
+    }
+
+    replay.nmem = (argc - optind) / 2;
+    struct emul_nvm_latency *emul_nvm_lats = (struct emul_nvm_latency *)calloc(sizeof(struct emul_nvm_latency), replay.nmem);
+    if (emul_nvm_lats == NULL) {
+        handle_error("calloc");
+    }
+    for (j = 0; j < replay.nmem; j++) {
+        emul_nvm_lats[j].read = (double)strtod(argv[optind++], NULL);
+        emul_nvm_lats[j].write = (double)strtod(argv[optind++], NULL);
+        if (emul_nvm_lats[j].read <= emul.dram_latency || emul_nvm_lats[j].write <= emul.dram_latency ||
+            emul_nvm_lats[j].read <= emul.remote_latency || emul_nvm_lats[j].write <= emul.remote_latency) {
+            exit_with_message("Failed to execute. NVM latency must be larger than DRAM latency.\n");
+        }
+    }
+    emul.emul_nvm_lats = emul_nvm_lats;
+    if (nbw > replay.nmem) {
+        exit_with_message("Failed to execute. More bandwidth ceilings of -B than the memory regions.\n");
+    }
+    struct emul_nvm_bandwidth *emul_nvm_bws = NULL;
+    if (nbw > 0) {
+        emul_nvm_bws = (struct emul_nvm_bandwidth *)calloc(sizeof(struct emul_nvm_bandwidth), replay.nmem);
+        if (emul_nvm_bws == NULL) {
+            handle_error("calloc");
+        }
+        memcpy(emul_nvm_bws, bw_limits, sizeof(struct emul_nvm_bandwidth) * nbw);
+    }
+    emul.emul_nvm_bws = emul_nvm_bws;
+
+    regions = (struct __trace_region *)calloc(sizeof(struct __trace_region), replay.nmem);
+    if (regions == NULL) {
+        handle_error("calloc");
+    }
+    while ((r = read_trace(&reader, &rec, regions, replay.nmem)) > 0) {
+        const struct __model *model = trace_model(rec.model);
+        struct __replay_mon *rm;
+        struct __model_input in;
+
+        if (model == NULL) {
+            exit_with_message("Failed to replay. Unknown model %u of tid %u\n", rec.model, rec.tid);
+        }
+        rm = lookup_replay_mon(rec.tgid, rec.tid);
+        rm->mon.model = model;
+        load_record(&rm->mon, &rec, regions, &in);
+        double delay = model->delay(&emul, rm - replay.mons, &rm->mon, &in);
+        rm->mon.total_delay += delay / 1000000000;
+        rm->epoch_time += (double)rec.epoch_nsec / 1000000000;
+        rm->epochs++;
+        nrecords++;
+        if (verbose) {
+            printf("%lu %u %u %s %lf\n", rec.time_ns, rec.tgid, rec.tid, model->name, delay);
+        }
+    }
+    if (r < 0) {
+        fprintf(stderr, "Warning: Failed to read the trace after %lu records\n", nrecords);
+    }
+
+    /* display results */
+    double total_delay = 0;
+    for (j = 0; j < replay.n; j++) {
+        struct __replay_mon *rm = &replay.mons[j];
+        printf("========== Thread [tgid=%u, tid=%u] replay summary ==========\n", rm->mon.tgid, rm->mon.tid);
+        printf("epochs        =%lu\n", rm->epochs);
+        printf("epoch time    =%lf\n", rm->epoch_time);
+        printf("total delay   =%lf\n", rm->mon.total_delay);
+        total_delay += rm->mon.total_delay;
+    }
+    printf("records=%lu, threads=%d, total delay=%lf\n", nrecords, replay.n, total_delay);
+
+    free(regions);
+    fini_replay_mons();
+    free(emul_nvm_lats);
+    free(emul_nvm_bws);
+    close_trace(&reader);
+    return r < 0 ? 1 : 0;
+}
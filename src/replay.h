@@ -0,0 +1,11 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#ifndef __REPLAY_H
+#define __REPLAY_H
+
+int replay_main(int, char *[]);
+#endif
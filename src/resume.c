@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "resume.h"
+#include "common.h"
+
+static uint64_t ts_to_nsec(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+int init_resume_sched(struct __resume_sched *sched, struct __monitor *mons, const int cap)
+{
+    sched->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (sched->fd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+    pthread_mutex_init(&sched->lock, NULL);
+    sched->cap = cap > 0 ? cap : 1;
+    sched->n = 0;
+    sched->heap = (struct __resume_entry *)calloc(sizeof(struct __resume_entry), sched->cap);
+    if (sched->heap == NULL) {
+        handle_error("calloc");
+    }
+    sched->armed = 0;
+    sched->mons = mons;
+    sched->resumed = 0;
+    sched->total_late = 0;
+    sched->max_late = 0;
+    return 0;
+}
+
+void fini_resume_sched(struct __resume_sched *sched)
+{
+    if (sched->fd >= 0) {
+        close(sched->fd);
+        sched->fd = -1;
+    }
+    pthread_mutex_destroy(&sched->lock);
+    free(sched->heap);
+    sched->heap = NULL;
+}
+
+static void swap_entry(struct __resume_entry *a, struct __resume_entry *b)
+{
+    struct __resume_entry t = *a;
+    *a = *b;
+    *b = t;
+}
+
+static void heap_push(struct __resume_sched *sched, const struct __resume_entry *e)
+{
+    int i, parent;
+
+    if (sched->n == sched->cap) {
+        sched->cap *= 2;
+        sched->heap = (struct __resume_entry *)realloc(sched->heap, sizeof(struct __resume_entry) * sched->cap);
+        if (sched->heap == NULL) {
+            handle_error("realloc");
+        }
+    }
+    i = sched->n++;
+    sched->heap[i] = *e;
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (sched->heap[parent].deadline <= sched->heap[i].deadline) {
+            break;
+        }
+        swap_entry(&sched->heap[parent], &sched->heap[i]);
+        i = parent;
+    }
+}
+
+static void heap_pop(struct __resume_sched *sched)
+{
+    int i = 0, l, r, min;
+
+    sched->heap[0] = sched->heap[--sched->n];
+    while (1) {
+        l = 2 * i + 1;
+        r = l + 1;
+        min = i;
+        if (l < sched->n && sched->heap[l].deadline < sched->heap[min].deadline) {
+            min = l;
+        }
+        if (r < sched->n && sched->heap[r].deadline < sched->heap[min].deadline) {
+            min = r;
+        }
+        if (min == i) {
+            break;
+        }
+        swap_entry(&sched->heap[min], &sched->heap[i]);
+        i = min;
+    }
+}
+
+/* Arm the timerfd at the earliest deadline. Called with the lock held. */
+static void arm_timer(struct __resume_sched *sched)
+{
+    struct itimerspec its = {{0, 0}, {0, 0}};
+    uint64_t deadline = sched->n > 0 ? sched->heap[0].deadline : 0;
+
+    if (deadline == sched->armed) {
+        return;
+    }
+    its.it_value.tv_sec  = deadline / 1000000000;
+    its.it_value.tv_nsec = deadline % 1000000000;
+    if (timerfd_settime(sched->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        handle_error("timerfd_settime");
+    }
+    sched->armed = deadline;
+}
+
+/*
+ * Resume the target-th monitor delay nsec after now. The monitor must be
+ * stopped. It is safe to be called from multiple workers.
+ */
+int schedule_resume(struct __resume_sched *sched, const int target, const struct timespec *now, const uint64_t delay)
+{
+    struct __monitor *mon = &sched->mons[target];
+    struct __resume_entry e = {
+        .deadline = ts_to_nsec(now) + delay,
+        .target = target,
+        .tgid = mon->tgid,
+        .tid = mon->tid,
+    };
+
+    pthread_mutex_lock(&sched->lock);
+    mon->resume_scheduled = true;
+    heap_push(sched, &e);
+    arm_timer(sched);
+    pthread_mutex_unlock(&sched->lock);
+    return 0;
+}
+
+/* Resume all the monitors whose deadline has passed. */
+void resume_due_mons(struct __resume_sched *sched)
+{
+    uint64_t expirations, now, late;
+    struct timespec ts;
+
+    /* clear the readiness of the timerfd */
+    if (read(sched->fd, &expirations, sizeof(expirations)) < 0) {
+        DEBUG_PRINT("no expiration of the resume timer\n");
+    }
+
+    pthread_mutex_lock(&sched->lock);
+    sched->armed = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = ts_to_nsec(&ts);
+    while (sched->n > 0 && sched->heap[0].deadline <= now) {
+        struct __resume_entry e = sched->heap[0];
+        struct __monitor *mon = &sched->mons[e.target];
+        heap_pop(sched);
+        /* the monitor might be terminated and reused while it is stopped */
+        if (!mon->resume_scheduled || mon->tgid != e.tgid || mon->tid != e.tid) {
+            continue;
+        }
+        mon->resume_scheduled = false;
+        if (mon->status != MONITOR_OFF) {
+            continue;
+        }
+        clear_mon_time(&mon->wasted_delay);
+        clear_mon_time(&mon->injected_delay);
+        run_mon(mon);
+        late = now - e.deadline;
+        sched->resumed++;
+        sched->total_late += late;
+        if (late > sched->max_late) {
+            sched->max_late = late;
+        }
+        DEBUG_PRINT("[%d:%u:%u] resumed %lu nsec after the deadline\n", e.target, mon->tgid, mon->tid, late);
+    }
+    arm_timer(sched);
+    pthread_mutex_unlock(&sched->lock);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#ifndef __RESUME_H
+#define __RESUME_H
+#include <pthread.h>
+#include "monitor.h"
+
+struct __resume_entry {
+    uint64_t deadline;      /* CLOCK_MONOTONIC in nsec */
+    int target;
+    pid_t tgid;
+    pid_t tid;
+};
+
+/*
+ * Min-heap of the deadlines to resume the stopped monitors. A timerfd is
+ * armed at the earliest deadline, so that a monitor is resumed when its
+ * delay expires instead of at the next epoch.
+ */
+struct __resume_sched {
+    int fd;
+    pthread_mutex_t lock;
+    struct __resume_entry *heap;
+    int n;
+    int cap;
+    uint64_t armed;         /* the deadline the timerfd is armed at, 0 if disarmed */
+    struct __monitor *mons;
+    uint64_t resumed;       /* statistics */
+    uint64_t total_late;
+    uint64_t max_late;
+};
+
+int init_resume_sched(struct __resume_sched *, struct __monitor *, const int);
+void fini_resume_sched(struct __resume_sched *);
+int schedule_resume(struct __resume_sched *, const int, const struct timespec *, const uint64_t);
+void resume_due_mons(struct __resume_sched *);
+#endif
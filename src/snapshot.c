@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#include "snapshot.h"
+#include "uncores.h"
+#include "incores.h"
+#include "perf.h"
+#include "common.h"
+
+#define GROUP_BUF_LEN (1 + INCORE_NR_EVENTS)
+#define LOAD_BUF_LEN (1 + INCORE_NR_LOAD_EVENTS)
+
+/* Kinds of the reads queued to io_uring, in the upper 32 bits of user_data */
+enum {
+    SNAP_READ_CBO = 0,
+    SNAP_READ_GROUP = 1,
+    SNAP_READ_EVENT = 2,
+    SNAP_READ_IMC = 3,
+    SNAP_READ_LOAD = 4,
+};
+
+int init_snapshot(struct __snapshot *snap)
+{
+    snap->cpus = (struct __cpu_elem *)calloc(sizeof(struct __cpu_elem), num_of_cpu());
+    if (snap->cpus == NULL) {
+        handle_error("calloc");
+    }
+    snap->cbos = (struct __cbo_elem *)calloc(sizeof(struct __cbo_elem), num_of_cbo());
+    if (snap->cbos == NULL) {
+        handle_error("calloc");
+    }
+    snap->groups = (uint64_t *)calloc(sizeof(uint64_t) * GROUP_BUF_LEN, num_of_cpu());
+    if (snap->groups == NULL) {
+        handle_error("calloc");
+    }
+    snap->loads = (uint64_t *)calloc(sizeof(uint64_t) * LOAD_BUF_LEN, num_of_cpu());
+    if (snap->loads == NULL) {
+        handle_error("calloc");
+    }
+    snap->imcs = (struct __imc_elem *)calloc(sizeof(struct __imc_elem), num_of_imc() + 1);
+    if (snap->imcs == NULL) {
+        handle_error("calloc");
+    }
+    snap->llc_wb = 0;
+    snap->all_dram_rds = 0;
+    snap->imc_rd = 0;
+    snap->imc_wr = 0;
+    return 0;
+}
+
+void fini_snapshot(struct __snapshot *snap)
+{
+    free(snap->cpus);
+    free(snap->cbos);
+    free(snap->groups);
+    free(snap->loads);
+    free(snap->imcs);
+    snap->cpus = NULL;
+    snap->cbos = NULL;
+    snap->groups = NULL;
+    snap->loads = NULL;
+    snap->imcs = NULL;
+}
+
+/* Create a ring large enough to read nparts-th of the counters at once. */
+int init_snapshot_uring(struct __uring *ring, const int nparts)
+{
+    unsigned entries = (num_of_cbo() + num_of_cpu() * (INCORE_NR_EVENTS + 1) + num_of_imc() * 2 + nparts - 1) / nparts;
+
+    if (entries > 4096) {
+        entries = 4096;
+    }
+    return init_uring(ring, entries);
+}
+
+static uint64_t *cpu_elem_value(struct __cpu_elem *elem, const int idx)
+{
+    switch (idx) {
+    case INCORE_ALL_DRAM_RDS:
+        return &elem->all_dram_rds;
+    case INCORE_L2STALL:
+        return &elem->cpu_l2stall_t;
+    case INCORE_LLCL_HITS:
+        return &elem->cpu_llcl_hits;
+    case INCORE_LLCR_MISS:
+        return &elem->cpu_llcr_miss;
+    default:
+        return &elem->cpu_llcl_miss;
+    }
+}
+
+static void snapshot_read_complete(uint64_t user_data, int res, void *arg)
+{
+    struct __snapshot *snap = (struct __snapshot *)arg;
+    uint32_t kind = user_data >> 32;
+    uint32_t i = (uint32_t)user_data;
+    int j;
+
+    if (res < 0) {
+        fprintf(stderr, "%s read failed. kind:%u index:%u res:%d\n", __func__, kind, i, res);
+        return;
+    }
+    if (kind == SNAP_READ_GROUP) {
+        uint64_t *buf = &snap->groups[i * GROUP_BUF_LEN];
+        if (buf[0] > INCORE_NR_EVENTS) {
+            fprintf(stderr, "%s unexpected group size. cpu:%u nr:%lu\n", __func__, i, buf[0]);
+            return;
+        }
+        for (j = 0; j < buf[0]; j++) {
+            *cpu_elem_value(&snap->cpus[i], j) = buf[1 + j];
+        }
+    } else if (kind == SNAP_READ_LOAD) {
+        uint64_t *buf = &snap->loads[i * LOAD_BUF_LEN];
+        if (buf[0] != INCORE_NR_LOAD_EVENTS) {
+            fprintf(stderr, "%s unexpected load group size. cpu:%u nr:%lu\n", __func__, i, buf[0]);
+            return;
+        }
+        snap->cpus[i].cpu_offcore_occ = buf[1 + INCORE_OFFCORE_OCC];
+        snap->cpus[i].cpu_offcore_cyc = buf[1 + INCORE_OFFCORE_CYC];
+    }
+}
+
+static void snapshot_uring_read(struct __uring *ring, struct __snapshot *snap,
+                                const int fd, void *buf, const unsigned len, const uint64_t user_data)
+{
+    while (uring_read(ring, fd, buf, len, user_data) < 0) {
+        /* the submission queue is full */
+        uring_wait(ring, snapshot_read_complete, snap);
+    }
+}
+
+/* The part reading the i-th CPU core, see init_workers(). */
+static inline int cpu_part(const struct __pmu_info *pmu, const int i, const int nparts)
+{
+    return (pmu->cpu_part != NULL && nparts > 1) ? pmu->cpu_part[i] : i % nparts;
+}
+
+/*
+ * Queue all the reads of the part to io_uring and submit them in a batch,
+ * so that the counters are read almost at the same time.
+ */
+static int read_snapshot_part_uring(struct __pmu_info *pmu, struct __snapshot *snap,
+                                    const int part, const int nparts, struct __uring *ring)
+{
+    int i, j;
+
+    for (i = part; i < num_of_cbo(); i += nparts) {
+        snapshot_uring_read(ring, snap, pmu->cbos[i].perf.fd, &snap->cbos[i].llc_wb, sizeof(uint64_t),
+                            ((uint64_t)SNAP_READ_CBO << 32) | i);
+    }
+    for (i = part; i < pmu->nimc; i += nparts) {
+        snapshot_uring_read(ring, snap, pmu->imcs[i].rd.perf.fd, &snap->imcs[i].cas_rd, sizeof(uint64_t),
+                            ((uint64_t)SNAP_READ_IMC << 32) | i);
+        snapshot_uring_read(ring, snap, pmu->imcs[i].wr.perf.fd, &snap->imcs[i].cas_wr, sizeof(uint64_t),
+                            ((uint64_t)SNAP_READ_IMC << 32) | i);
+    }
+    for (i = 0; i < num_of_cpu(); i++) {
+        if (cpu_part(pmu, i, nparts) != part) {
+            continue;
+        }
+        struct __incore *inc = &pmu->cpus[i];
+        if (inc->rdpmc && perf_can_rdpmc(&inc->perf[INCORE_ALL_DRAM_RDS])) {
+            read_cpu_elems(inc, &snap->cpus[i]);
+            continue;
+        }
+        if (inc->nload > 0) {
+            snapshot_uring_read(ring, snap, inc->load[INCORE_OFFCORE_OCC].fd, &snap->loads[i * LOAD_BUF_LEN],
+                                sizeof(uint64_t) * LOAD_BUF_LEN, ((uint64_t)SNAP_READ_LOAD << 32) | i);
+        }
+        if (inc->grouped) {
+            snapshot_uring_read(ring, snap, inc->perf[INCORE_ALL_DRAM_RDS].fd, &snap->groups[i * GROUP_BUF_LEN],
+                                sizeof(uint64_t) * (1 + inc->nevents), ((uint64_t)SNAP_READ_GROUP << 32) | i);
+        } else {
+            for (j = 0; j < inc->nevents; j++) {
+                snapshot_uring_read(ring, snap, inc->perf[j].fd, cpu_elem_value(&snap->cpus[i], j), sizeof(uint64_t),
+                                    ((uint64_t)SNAP_READ_EVENT << 32) | i);
+            }
+        }
+    }
+    return uring_wait(ring, snapshot_read_complete, snap) == 0 ? 0 : -1;
+}
+
+/*
+ * Read the part-th of nparts of the CPU cores and CBos. The sums are not
+ * updated; call sum_snapshot() after all the parts are read. If ring is
+ * not NULL, the reads are done in a batch with io_uring.
+ */
+int read_snapshot_part(struct __pmu_info *pmu, struct __snapshot *snap, const int part, const int nparts,
+                       struct __uring *ring)
+{
+    int i, r = 0;
+
+    if (ring != NULL) {
+        return read_snapshot_part_uring(pmu, snap, part, nparts, ring);
+    }
+
+    for (i = part; i < num_of_cbo(); i += nparts) {
+        if (read_cbo_elems(&pmu->cbos[i], &snap->cbos[i]) < 0) {
+            r = -1;
+        }
+    }
+    for (i = part; i < pmu->nimc; i += nparts) {
+        if (read_imc_elems(&pmu->imcs[i], &snap->imcs[i]) < 0) {
+            r = -1;
+        }
+    }
+    for (i = 0; i < num_of_cpu(); i++) {
+        if (cpu_part(pmu, i, nparts) != part) {
+            continue;
+        }
+        if (read_cpu_elems(&pmu->cpus[i], &snap->cpus[i]) < 0) {
+            r = -1;
+        }
+    }
+    return r;
+}
+
+void sum_snapshot(struct __snapshot *snap)
+{
+    int i;
+
+    snap->llc_wb = 0;
+    for (i = 0; i < num_of_cbo(); i++) {
+        snap->llc_wb += snap->cbos[i].llc_wb;
+    }
+    snap->all_dram_rds = 0;
+    for (i = 0; i < num_of_cpu(); i++) {
+        snap->all_dram_rds += snap->cpus[i].all_dram_rds;
+    }
+    /* all zero without bandwidth ceilings */
+    snap->imc_rd = 0;
+    snap->imc_wr = 0;
+    for (i = 0; i < num_of_imc(); i++) {
+        snap->imc_rd += snap->imcs[i].cas_rd;
+        snap->imc_wr += snap->imcs[i].cas_wr;
+    }
+}
+
+int read_snapshot(struct __pmu_info *pmu, struct __snapshot *snap)
+{
+    int r;
+
+    r = read_snapshot_part(pmu, snap, 0, 1, NULL);
+    sum_snapshot(snap);
+    return r;
+}
+
+/* Save the values which a monitor of the CPU core needs as its baseline. */
+void copy_snapshot_elem(const struct __snapshot *snap, const uint32_t cpu, struct __elem *elem)
+{
+    elem->llc_wb       = snap->llc_wb;
+    elem->all_dram_rds = snap->all_dram_rds;
+    elem->imc_rd       = snap->imc_rd;
+    elem->imc_wr       = snap->imc_wr;
+    elem->cpu          = snap->cpus[cpu];
+}
@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+#include "types.h"
+#include "uring.h"
+
+int init_snapshot(struct __snapshot *);
+void fini_snapshot(struct __snapshot *);
+int read_snapshot(struct __pmu_info *, struct __snapshot *);
+int read_snapshot_part(struct __pmu_info *, struct __snapshot *, const int, const int, struct __uring *);
+int init_snapshot_uring(struct __uring *, const int);
+void sum_snapshot(struct __snapshot *);
+void copy_snapshot_elem(const struct __snapshot *, const uint32_t, struct __elem *);
+#endif
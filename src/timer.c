@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include "timer.h"
+#include "common.h"
+
+int init_epoch_timer(struct __epoch_timer *timer, const struct timespec *interval)
+{
+    struct itimerspec its;
+
+    timer->interval = *interval;
+    timer->epochs = 0;
+    timer->overruns = 0;
+    timer->sched = NULL;
+    timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer->fd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+
+    /* The first expiration is one interval later, and then periodically. */
+    its.it_value = *interval;
+    its.it_interval = *interval;
+    if (timerfd_settime(timer->fd, 0, &its, NULL) < 0) {
+        perror("timerfd_settime");
+        close(timer->fd);
+        timer->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Wait for the next deadline, and return the number of the epochs which
+ * elapsed. It is more than 1 if the previous epoch overran its deadline.
+ * now is set to the time of the wake-up. The monitors whose delay expires
+ * in the meantime are resumed if the resume scheduler is set.
+ */
+int wait_epoch_timer(struct __epoch_timer *timer, struct timespec *now)
+{
+    uint64_t expirations = 0;
+    ssize_t r;
+
+    while (timer->sched != NULL) {
+        struct pollfd fds[2] = {
+            { .fd = timer->fd,        .events = POLLIN },
+            { .fd = timer->sched->fd, .events = POLLIN },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            handle_error("Failed to poll the epoch timer");
+        }
+        if (fds[1].revents & POLLIN) {
+            resume_due_mons(timer->sched);
+        }
+        if (fds[0].revents & POLLIN) {
+            break;
+        }
+    }
+
+    do {
+        r = read(timer->fd, &expirations, sizeof(expirations));
+    } while (r < 0 && errno == EINTR);
+    if (r != sizeof(expirations)) {
+        handle_error("Failed to wait the epoch timer");
+    }
+    clock_gettime(CLOCK_MONOTONIC, now);
+
+    timer->epochs += expirations;
+    if (expirations > 1) {
+        timer->overruns += expirations - 1;
+        fprintf(stderr, "warning: the epoch overran its deadline. %lu epoch(s) skipped, %lu in total\n",
+                expirations - 1, timer->overruns);
+    }
+    return (int)expirations;
+}
+
+void fini_epoch_timer(struct __epoch_timer *timer)
+{
+    if (timer->fd >= 0) {
+        close(timer->fd);
+        timer->fd = -1;
+    }
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#ifndef __TIMER_H
+#define __TIMER_H
+#include <stdint.h>
+#include <time.h>
+#include "resume.h"
+
+/*
+ * The epoch clock. It expires at fixed absolute deadlines, so the time
+ * spent in an epoch does not delay the following epochs.
+ */
+struct __epoch_timer {
+    int fd;
+    struct timespec interval;
+    uint64_t epochs;        /* the number of the expirations */
+    uint64_t overruns;      /* the number of the expirations missed */
+    struct __resume_sched *sched;   /* served while waiting, if not NULL */
+};
+
+int init_epoch_timer(struct __epoch_timer *, const struct timespec *);
+int wait_epoch_timer(struct __epoch_timer *, struct timespec *);
+void fini_epoch_timer(struct __epoch_timer *);
+#endif
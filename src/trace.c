@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "trace.h"
+#include "emul.h"
+#include "media.h"
+#include "common.h"
+
+/* Records are written by the workers of -j concurrently. */
+static struct {
+    FILE *fp;
+    pthread_mutex_t lock;
+} trace = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const struct __model *trace_models[] = {
+    [TRACE_MODEL_SINGLE] = &single_model,
+    [TRACE_MODEL_HYBRID] = &hybrid_model,
+    [TRACE_MODEL_NUMA] = &numa_model,
+};
+
+static uint32_t trace_model_id(const struct __model *model)
+{
+    uint32_t k;
+
+    for (k = 0; k < sizeof(trace_models) / sizeof(trace_models[0]); k++) {
+        if (trace_models[k] == model) {
+            return k;
+        }
+    }
+    return TRACE_MODEL_SINGLE;
+}
+
+/* The model of the id in a record, NULL if unknown. */
+const struct __model *trace_model(const uint32_t id)
+{
+    if (id >= sizeof(trace_models) / sizeof(trace_models[0])) {
+        return NULL;
+    }
+    return trace_models[id];
+}
+
+/* Record the epochs to path, with the parameters of the host in emul. */
+int init_trace(const char *path, const struct __emul *emul)
+{
+    struct __trace_header header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .flags = (pebs_stores_enabled() ? TRACE_STORES : 0) | (media_enabled() ? TRACE_MEDIA : 0),
+        .interval_ns = (uint64_t)emul->waittime.tv_sec * 1000000000 + emul->waittime.tv_nsec,
+        .cpu_freq = emul->cpu_freq,
+        .weight = emul->weight,
+        .dram_latency = emul->dram_latency,
+        .remote_latency = emul->remote_latency,
+    };
+
+    trace.fp = fopen(path, "wb");
+    if (trace.fp == NULL) {
+        perror("fopen");
+        return -1;
+    }
+    if (fwrite(&header, sizeof(header), 1, trace.fp) != 1) {
+        perror("fwrite");
+        fclose(trace.fp);
+        trace.fp = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void fini_trace(void)
+{
+    if (trace.fp == NULL) {
+        return;
+    }
+    fclose(trace.fp);
+    trace.fp = NULL;
+}
+
+bool trace_enabled(void)
+{
+    return trace.fp != NULL;
+}
+
+/*
+ * Record the epoch of the monitor, after its PEBS samples are collected
+ * and before they are consumed by the model.
+ */
+int trace_epoch(const struct __monitor *mon, const struct __epoch *ep, const struct __model_input *in)
+{
+    const struct __pebs_elem *pa = &mon->after->pebs, *pb = &mon->before->pebs;
+    const struct __pebs_elem *sa = &mon->after->store, *sb = &mon->before->store;
+    struct __trace_region regions[mon->num_of_region > 0 ? mon->num_of_region : 1];
+    struct __trace_record rec = {
+        .time_ns = (uint64_t)ep->start_ts.tv_sec * 1000000000 + ep->start_ts.tv_nsec,
+        .tgid = mon->tgid,
+        .tid = mon->tid,
+        .model = trace_model_id(mon->model),
+        .flags = mon->region_index.phys ? TRACE_PHYS : 0,
+        .nregions = mon->num_of_region,
+        .wb_cnt = in->wb_cnt,
+        .cpus_dram_rds = in->cpus_dram_rds,
+        .l2stall = in->l2stall,
+        .llchits = in->llchits,
+        .llcmiss = in->llcmiss,
+        .llcrmiss = in->llcrmiss,
+        .imc_rd = in->imc_rd,
+        .imc_wr = in->imc_wr,
+        .epoch_nsec = in->epoch_nsec,
+        .offcore_occ = in->offcore_occ,
+        .offcore_cyc = in->offcore_cyc,
+        .pebs_total = pa->total - pb->total,
+        .pebs_llcmiss = pa->llcmiss - pb->llcmiss,
+        .pebs_lost = pa->lost - pb->lost,
+        .pebs_nsamples = pa->nsamples - pb->nsamples,
+        .pebs_media_hits = pa->media_hits - pb->media_hits,
+        .store_total = sa->total - sb->total,
+        .store_lost = sa->lost - sb->lost,
+        .store_nsamples = sa->nsamples - sb->nsamples,
+    };
+    int j, r = 0;
+
+    for (j = 0; j < mon->num_of_region; j++) {
+        regions[j].pebs_sample = pa->sample[j] - pb->sample[j];
+        regions[j].store_sample = sa->sample[j] - sb->sample[j];
+    }
+
+    pthread_mutex_lock(&trace.lock);
+    if (fwrite(&rec, sizeof(rec), 1, trace.fp) != 1 ||
+        (rec.nregions > 0 && fwrite(regions, sizeof(struct __trace_region), rec.nregions, trace.fp) != rec.nregions)) {
+        perror("fwrite");
+        r = -1;
+    }
+    pthread_mutex_unlock(&trace.lock);
+    return r;
+}
+
+int open_trace(struct __trace_reader *reader, const char *path)
+{
+    reader->fp = fopen(path, "rb");
+    if (reader->fp == NULL) {
+        perror("fopen");
+        return -1;
+    }
+    if (fread(&reader->header, sizeof(reader->header), 1, reader->fp) != 1 ||
+        memcmp(reader->header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+        reader->header.version != TRACE_VERSION) {
+        fprintf(stderr, "%s %s is not a trace of this version\n", __func__, path);
+        close_trace(reader);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Read the next record and its regions, up to max. Return 1 if read, 0 at
+ * the end of the file and -1 on errors.
+ */
+int read_trace(struct __trace_reader *reader, struct __trace_record *rec, struct __trace_region *regions, const uint32_t max)
+{
+    if (fread(rec, sizeof(*rec), 1, reader->fp) != 1) {
+        return feof(reader->fp) ? 0 : -1;
+    }
+    if (rec->nregions > max) {
+        fprintf(stderr, "%s too many regions. tid:%u nregions:%u\n", __func__, rec->tid, rec->nregions);
+        return -1;
+    }
+    if (rec->nregions > 0 && fread(regions, sizeof(*regions), rec->nregions, reader->fp) != rec->nregions) {
+        fprintf(stderr, "%s truncated record. tid:%u\n", __func__, rec->tid);
+        return -1;
+    }
+    return 1;
+}
+
+void close_trace(struct __trace_reader *reader)
+{
+    if (reader->fp != NULL) {
+        fclose(reader->fp);
+        reader->fp = NULL;
+    }
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct __emul;
+struct __epoch;
+struct __monitor;
+struct __model;
+struct __model_input;
+
+/*
+ * The counter values of each monitor in each epoch, i.e., the input of the
+ * latency models, recorded with -O and replayed by "mes replay":
+ *
+ *   file:   struct __trace_header, then records
+ *   record: struct __trace_record, then nregions of struct __trace_region
+ *
+ * All the values are the differences in the epoch. All the fields are in
+ * the byte order of the host.
+ */
+#define TRACE_MAGIC "MESTRAC"
+#define TRACE_VERSION 2
+
+/* flags of the header */
+#define TRACE_STORES 0x1    /* stores are sampled, see -s */
+#define TRACE_MEDIA  0x2    /* the media buffer is modeled, see -x */
+
+/* flags of a record */
+#define TRACE_PHYS   0x1    /* the samples are classified by the physical addresses, see -P */
+
+enum {
+    TRACE_MODEL_SINGLE = 0,
+    TRACE_MODEL_HYBRID = 1,
+    TRACE_MODEL_NUMA = 2,
+};
+
+struct __trace_header {
+    char magic[8];          /* TRACE_MAGIC */
+    uint32_t version;
+    uint32_t flags;
+    uint64_t interval_ns;   /* the interval of the epochs */
+    double cpu_freq;
+    double weight;
+    double dram_latency;
+    double remote_latency;  /* 0 without -N */
+};
+
+struct __trace_record {
+    uint64_t time_ns;       /* CLOCK_MONOTONIC at the start of the epoch */
+    uint32_t tgid;
+    uint32_t tid;
+    uint32_t model;         /* TRACE_MODEL_* */
+    uint32_t flags;
+    uint32_t nregions;
+    uint32_t reserved;
+    /* struct __model_input */
+    uint64_t wb_cnt;
+    uint64_t cpus_dram_rds;
+    uint64_t l2stall;
+    uint64_t llchits;
+    uint64_t llcmiss;
+    uint64_t llcrmiss;
+    uint64_t imc_rd;
+    uint64_t imc_wr;
+    uint64_t epoch_nsec;
+    uint64_t offcore_occ;
+    uint64_t offcore_cyc;
+    /* struct __pebs_elem of the loads and the stores */
+    uint64_t pebs_total;
+    uint64_t pebs_llcmiss;
+    uint64_t pebs_lost;
+    uint64_t pebs_nsamples;
+    uint64_t pebs_media_hits;
+    uint64_t store_total;
+    uint64_t store_lost;
+    uint64_t store_nsamples;
+};
+
+struct __trace_region {
+    uint64_t pebs_sample;
+    uint64_t store_sample;
+};
+
+struct __trace_reader {
+    FILE *fp;
+    struct __trace_header header;
+};
+
+int init_trace(const char *, const struct __emul *);
+void fini_trace(void);
+bool trace_enabled(void);
+int trace_epoch(const struct __monitor *, const struct __epoch *, const struct __model_input *);
+
+int open_trace(struct __trace_reader *, const char *);
+int read_trace(struct __trace_reader *, struct __trace_record *, struct __trace_region *, const uint32_t);
+void close_trace(struct __trace_reader *);
+const struct __model *trace_model(const uint32_t);
+#endif
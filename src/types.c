@@ -5,6 +5,7 @@
 /*  vim: set expandtab ts=4 sw=4 ai: */
 
 #include "types.h"
+#include <string.h>
 #include "common.h"
 
 /* CPU Models */
@@ -52,6 +53,37 @@ const struct __model_context model_ctx[] = {
          *   cpu/umask=0x1,event=0xd3/
          */
         0x01d3,
+        /*
+         * cpu_llcr_miss_config:
+         *   mem_load_uops_l3_miss_retired.remote_dram
+         *   cpu/umask=0x4,event=0xd3/
+         */
+        0x04d3,
+        "/sys/bus/event_source/devices/%s/type",
+        /*
+         * imc_rd_config:
+         *   unc_m_cas_count.rd
+         *   umask=0x3,event=0x4
+         */
+        0x0304,
+        /*
+         * imc_wr_config:
+         *   unc_m_cas_count.wr
+         *   umask=0xc,event=0x4
+         */
+        0x0c04,
+        /*
+         * cpu_offcore_occ_config:
+         *   offcore_requests_outstanding.all_data_rd
+         *   cpu/umask=0x8,event=0x60/
+         */
+        0x0860,
+        /*
+         * cpu_offcore_cyc_config:
+         *   offcore_requests_outstanding.cycles_with_data_rd
+         *   cpu/umask=0x8,cmask=0x1,event=0x60/
+         */
+        0x1000860,
         }
     },
     /*
@@ -91,6 +123,37 @@ const struct __model_context model_ctx[] = {
          *   cpu/umask=0x1,event=0xd3/
          */
         0x01d3,
+        /*
+         * cpu_llcr_miss_config:
+         *   mem_load_l3_miss_retired.remote_dram
+         *   cpu/umask=0x2,event=0xd3/
+         */
+        0x02d3,
+        "/sys/bus/event_source/devices/%s/type",
+        /*
+         * imc_rd_config:
+         *   UNC_M_CAS_COUNT.RD
+         *   umask=0x3,event=0x4
+         */
+        0x0304,
+        /*
+         * imc_wr_config:
+         *   UNC_M_CAS_COUNT.WR
+         *   umask=0xc,event=0x4
+         */
+        0x0c04,
+        /*
+         * cpu_offcore_occ_config:
+         *   offcore_requests_outstanding.all_data_rd
+         *   cpu/umask=0x8,event=0x60/
+         */
+        0x0860,
+        /*
+         * cpu_offcore_cyc_config:
+         *   offcore_requests_outstanding.cycles_with_data_rd
+         *   cpu/umask=0x8,cmask=0x1,event=0x60/
+         */
+        0x1000860,
         }
     },
     {CPU_MDL_END, {0}}
@@ -144,6 +207,95 @@ int num_of_cbo(void)
     return ncbo;
 }
 
+/*
+ * The IMC PMUs are counted on a CPU core of each package in their cpumask,
+ * since an uncore PMU of sysfs stands for the IMCs of the same index in all
+ * the packages.
+ */
+#define MAX_IMC_UNITS 256
+
+static int nimc = -1;
+static struct {
+    char name[64];
+    int cpu;
+} imc_units[MAX_IMC_UNITS];
+
+/* Add the units of the PMU name, one for each CPU core in its cpumask. */
+static void add_imc_units(const char *name)
+{
+    char path[128], buf[256], *p, *end;
+    FILE *fp;
+    long first, last;
+
+    snprintf(path, sizeof(path), "/sys/bus/event_source/devices/%s/cpumask", name);
+    fp = fopen(path, "r");
+    if (fp == NULL || fgets(buf, sizeof(buf), fp) == NULL) {
+        /* assume a single package */
+        strcpy(buf, "0");
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    /* a list such as "0,28" or "0-1" */
+    for (p = buf; *p != '\0' && *p != '\n'; p = (*end == ',') ? end + 1 : end) {
+        first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+        for (; first <= last && nimc < MAX_IMC_UNITS; first++) {
+            snprintf(imc_units[nimc].name, sizeof(imc_units[nimc].name), "%s", name);
+            imc_units[nimc].cpu = (int)first;
+            DEBUG_PRINT("imc unit %d: %s on cpu %d\n", nimc, name, imc_units[nimc].cpu);
+            nimc++;
+        }
+    }
+}
+
+static int
+is_uncore_imc(const struct dirent *de)
+{
+    return !fnmatch("uncore_imc_[0-9]*", de->d_name, FNM_PATHNAME);
+}
+
+/* The number of the IMC units of all the packages. Unlike CBos, 0 is not an error. */
+int num_of_imc(void)
+{
+    struct dirent **namelist;
+    int i, n;
+
+    if (nimc >= 0) {
+        return nimc;
+    }
+
+    n = scandir("/sys/bus/event_source/devices/", &namelist, is_uncore_imc, NULL);
+    nimc = 0;
+    if (n > 0) {
+        for (i = 0; i < n; i++) {
+            add_imc_units(namelist[i]->d_name);
+            free(namelist[i]);
+        }
+        free(namelist);
+    }
+    DEBUG_PRINT("num_of_imc=%d\n", nimc);
+    return nimc;
+}
+
+/* The PMU name and the CPU core of the idx-th IMC unit. */
+int imc_unit(const int idx, const char **name, int *cpu)
+{
+    if (idx < 0 || idx >= num_of_imc()) {
+        return -1;
+    }
+    *name = imc_units[idx].name;
+    *cpu = imc_units[idx].cpu;
+    return 0;
+}
+
 static double cpu_MHz = 0;
 
 double cpu_frequency(void)
@@ -40,6 +40,12 @@ struct emul_nvm_latency {
     double write;
 };
 
+/* The bandwidth ceilings of a memory region in GB/s, 0 if not limited. */
+struct emul_nvm_bandwidth {
+    double read;
+    double write;
+};
+
 struct __perf_info {
     int   fd;
     int   group_fd;
@@ -47,22 +53,41 @@ struct __perf_info {
     pid_t pid;
     unsigned long flags;
     struct perf_event_attr attr;
+    struct perf_event_mmap_page *mp;    /* for rdpmc, NULL if not mapped */
+    struct {
+        uint64_t raw;       /* the count of the last read */
+        uint64_t enabled;   /* the times in nsec of the last read */
+        uint64_t running;
+        uint64_t scaled;    /* the sum of the scaled counts */
+    } scale;                /* see perf_scale() */
 };
 
 struct __cbo_elem {
     uint64_t llc_wb;
 };
 
+/* CAS commands of an integrated memory controller, 64 bytes each */
+struct __imc_elem {
+    uint64_t cas_rd;
+    uint64_t cas_wr;
+};
+
 struct __cpu_elem {
     uint64_t all_dram_rds;
     uint64_t cpu_l2stall_t;
     uint64_t cpu_llcl_hits;
     uint64_t cpu_llcl_miss;
+    uint64_t cpu_llcr_miss;     /* counted only when the remote node is emulated */
+    uint64_t cpu_offcore_occ;   /* counted only with the load curve of -q */
+    uint64_t cpu_offcore_cyc;
 };
 
 struct __pebs_elem {
     uint64_t total;
     uint64_t llcmiss;
+    uint64_t lost;      /* samples dropped by the kernel */
+    uint64_t nsamples;  /* all the samples, including those out of the regions */
+    uint64_t media_hits;    /* load samples in the regions combined in the media buffer */
     uint64_t *sample;
 };
 
@@ -75,9 +100,26 @@ struct __cpu_info {
 
 struct __elem {
     struct __cpu_info cpuinfo;
+    uint64_t llc_wb;            /* the sum of all the CBos */
+    uint64_t all_dram_rds;      /* the sum of all the CPU cores */
+    uint64_t imc_rd;            /* the sum of all the IMCs */
+    uint64_t imc_wr;
+    struct __cpu_elem cpu;      /* the CPU core of the monitor */
+    struct __pebs_elem pebs;
+    struct __pebs_elem store;   /* PEBS samples of stores */
+};
+
+/* Counter values of all the CPU cores and CBos read once per epoch. */
+struct __snapshot {
     struct __cbo_elem *cbos;
     struct __cpu_elem *cpus;
-    struct __pebs_elem pebs;
+    struct __imc_elem *imcs;
+    uint64_t *groups;       /* buffers of the grouped reads via io_uring */
+    uint64_t *loads;        /* buffers of the load groups via io_uring */
+    uint64_t llc_wb;
+    uint64_t all_dram_rds;
+    uint64_t imc_rd;
+    uint64_t imc_wr;
 };
 
 struct __uncore {
@@ -85,13 +127,48 @@ struct __uncore {
     struct __perf_info perf;
 };
 
+struct __imc {
+    struct __uncore rd;
+    struct __uncore wr;
+};
+
+/* Indexes of the in-core events. The first one is the group leader. */
+enum {
+    INCORE_ALL_DRAM_RDS = 0,
+    INCORE_L2STALL = 1,
+    INCORE_LLCL_HITS = 2,
+    INCORE_LLCL_MISS = 3,
+    INCORE_LLCR_MISS = 4,
+    INCORE_NR_EVENTS = 5
+};
+
+/*
+ * Indexes of the events of the load group, opened apart from the events
+ * above so that it does not need more counters than a core has.
+ */
+enum {
+    INCORE_OFFCORE_OCC = 0,
+    INCORE_OFFCORE_CYC = 1,
+    INCORE_NR_LOAD_EVENTS = 2
+};
+
 struct __incore {
-    struct __perf_info perf[4];
+    int nevents;    /* the number of the opened events */
+    bool grouped;   /* read with PERF_FORMAT_GROUP in a single read() */
+    bool rdpmc;     /* read with rdpmc on the CPU core if possible */
+    struct __perf_info perf[INCORE_NR_EVENTS];
+    int nload;      /* the number of the opened events of the load group, 0 if not opened */
+    struct __perf_info load[INCORE_NR_LOAD_EVENTS];
 };
 
 struct __pmu_info {
+    bool rdpmc;
+    bool uring;
     struct __uncore *cbos;
     struct __incore *cpus;
+    int nimc;               /* the number of the opened IMCs, 0 without bandwidth ceilings */
+    struct __imc *imcs;
+    int *cpu_part;          /* the part reading each CPU core, NULL if by the index; see init_workers() */
 };
 
 struct __region_info {
@@ -101,6 +178,8 @@ struct __region_info {
 
 int num_of_cpu(void);
 int num_of_cbo(void);
+int num_of_imc(void);
+int imc_unit(const int, const char **, int *);
 double cpu_frequency(void);
 int detect_model(const uint32_t);
 
@@ -112,6 +191,12 @@ struct __perf_configs {
     uint64_t cpu_l2stall_config;
     uint64_t cpu_llcl_hits_config;
     uint64_t cpu_llcl_miss_config;
+    uint64_t cpu_llcr_miss_config;
+    const char *path_format_imc_type;
+    uint64_t imc_rd_config;
+    uint64_t imc_wr_config;
+    uint64_t cpu_offcore_occ_config;
+    uint64_t cpu_offcore_cyc_config;
 };
 
 struct __model_context {
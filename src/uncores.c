@@ -37,17 +37,13 @@ int unfreeze_counters_cbo_all(struct __pmu_info *pmu)
     return 0;
 }
 
-int init_cbo(struct __uncore *unc, const uint32_t unc_idx)
+/* Read the PMU type of an uncore unit from the sysfs file of path. */
+static int read_uncore_type_path(const char *path, uint32_t *type)
 {
-    int ret, fd;
+    int fd;
     ssize_t r;
     unsigned long value;
-    char path[64], buf[32];
-
-    memset(path, 0, sizeof(path));
-    snprintf(path, sizeof(path) - 1,
-             perf_config.path_format_cbo_type,
-             unc_idx);
+    char buf[32];
 
     fd = open(path, O_RDONLY);
     if (fd < 0) {
@@ -69,20 +65,49 @@ int init_cbo(struct __uncore *unc, const uint32_t unc_idx)
         perror("strtoul");
         return -1;
     }
+    *type = (uint32_t)value;
+    return 0;
+}
 
-    unc->perf.cpu      = (int)unc_idx;
+/* Read the PMU type of the unc_idx-th uncore unit from sysfs. */
+static int read_uncore_type(const char *path_format, const uint32_t unc_idx, uint32_t *type)
+{
+    char path[64];
+
+    memset(path, 0, sizeof(path));
+    snprintf(path, sizeof(path) - 1,
+             path_format,
+             unc_idx);
+    return read_uncore_type_path(path, type);
+}
+
+static int init_uncore_perf(struct __uncore *unc, const int cpu, const uint32_t type, const uint64_t config)
+{
+    unc->perf.cpu      = cpu;
     unc->perf.pid      = -1; /* when using uncore, pid must be -1. */
     unc->perf.group_fd = -1;
     memset(&unc->perf.attr, 0, sizeof(struct perf_event_attr));
-    unc->perf.attr.type   = (uint32_t) value;
-    unc->perf.attr.config = perf_config.cbo_config;
+    unc->perf.attr.type   = type;
+    unc->perf.attr.config = config;
     unc->perf.attr.size   = sizeof(struct perf_event_attr);
     unc->perf.attr.inherit  = 1;
     unc->perf.attr.disabled = 1;
     unc->perf.attr.enable_on_exec = 1;
     /* when using uncore, don't set exclude_xxx flags. */
 
-    ret = perf_init(&unc->perf);
+    return perf_init(&unc->perf);
+}
+
+int init_cbo(struct __uncore *unc, const uint32_t unc_idx)
+{
+    int ret;
+    uint32_t type;
+
+    if (read_uncore_type(perf_config.path_format_cbo_type, unc_idx, &type) < 0) {
+        return -1;
+    }
+
+    ret = init_uncore_perf(unc, (int)unc_idx, type, perf_config.cbo_config);
     if (ret < 0) {
         fprintf(stderr, "%s cbo:%u init perf counter failed.\n", __func__, unc_idx);
     }
@@ -145,3 +170,103 @@ int read_cbo_elems(struct __uncore *unc, struct __cbo_elem *elem)
     DEBUG_PRINT("llc_wb:%lu\n", elem->llc_wb);
     return r;
 }
+
+/*
+ * Open the CAS counters of the unc_idx-th IMC unit, i.e., an IMC of a
+ * package. They count the traffic of the memory controller, not of a CPU
+ * core, and are opened on the CPU core of the package given by sysfs.
+ */
+int init_imc(struct __imc *imc, const uint32_t unc_idx)
+{
+    uint32_t type;
+    const char *name;
+    char path[128];
+    int cpu;
+
+    if (imc_unit(unc_idx, &name, &cpu) < 0) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), perf_config.path_format_imc_type, name);
+    if (read_uncore_type_path(path, &type) < 0) {
+        return -1;
+    }
+    imc->rd.unc_idx = unc_idx;
+    imc->wr.unc_idx = unc_idx;
+    if (init_uncore_perf(&imc->rd, cpu, type, perf_config.imc_rd_config) < 0 ||
+        init_uncore_perf(&imc->wr, cpu, type, perf_config.imc_wr_config) < 0) {
+        fprintf(stderr, "%s imc:%u init perf counter failed.\n", __func__, unc_idx);
+        return -1;
+    }
+    return 0;
+}
+
+void fini_imc(struct __imc *imc)
+{
+    perf_fini(&imc->rd.perf);
+    perf_fini(&imc->wr.perf);
+}
+
+/* Open the CAS counters of all the IMCs of all the packages for the bandwidth ceilings. */
+int init_all_imcs(struct __pmu_info *pmu)
+{
+    int i, r;
+
+    pmu->nimc = num_of_imc();
+    if (pmu->nimc == 0) {
+        fprintf(stderr, "%s no IMC is found.\n", __func__);
+        return -1;
+    }
+    pmu->imcs = (struct __imc *)calloc(sizeof(struct __imc), pmu->nimc);
+    if (pmu->imcs == NULL) {
+        handle_error("calloc");
+    }
+
+    for (i = 0; i < pmu->nimc; i++) {
+        pmu->imcs[i].rd.perf.fd = -1;
+        pmu->imcs[i].wr.perf.fd = -1;
+    }
+    for (i = 0; i < pmu->nimc; i++) {
+        r = init_imc(&pmu->imcs[i], i);
+        if (r < 0) {
+            fprintf(stderr, "%s init_imc failed i:%d\n", __func__, i);
+            return r;
+        }
+        r = perf_start(&pmu->imcs[i].rd.perf);
+        if (r < 0 || (r = perf_start(&pmu->imcs[i].wr.perf)) < 0) {
+            fprintf(stderr, "%s perf_start failed. imc:%d\n", __func__, i);
+            return r;
+        }
+    }
+    return 0;
+}
+
+void fini_all_imcs(struct __pmu_info *pmu)
+{
+    int i;
+
+    for (i = 0; i < pmu->nimc; i++) {
+        fini_imc(&pmu->imcs[i]);
+    }
+    free(pmu->imcs);
+    pmu->imcs = NULL;
+    pmu->nimc = 0;
+}
+
+int read_imc_elems(struct __imc *imc, struct __imc_elem *elem)
+{
+    ssize_t r;
+
+    r = perf_read_pmu(&imc->rd.perf, &elem->cas_rd);
+    if (r < 0) {
+        fprintf(stderr, "%s perf_read_pmu failed.\n", __func__);
+        return r;
+    }
+    r = perf_read_pmu(&imc->wr.perf, &elem->cas_wr);
+    if (r < 0) {
+        fprintf(stderr, "%s perf_read_pmu failed.\n", __func__);
+        return r;
+    }
+
+    DEBUG_PRINT("cas_rd:%lu cas_wr:%lu\n", elem->cas_rd, elem->cas_wr);
+    return r;
+}
@@ -19,5 +19,10 @@ void fini_cbo(struct __uncore *unc);
 int init_all_cbos(struct __pmu_info *pmu);
 void fini_all_cbos(struct __pmu_info *pmu);
 int read_cbo_elems(struct __uncore *unc, struct __cbo_elem *elem);
+int init_imc(struct __imc *imc, const uint32_t unc_idx);
+void fini_imc(struct __imc *imc);
+int init_all_imcs(struct __pmu_info *pmu);
+void fini_all_imcs(struct __pmu_info *pmu);
+int read_imc_elems(struct __imc *imc, struct __imc_elem *elem);
 #endif
 
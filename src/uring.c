@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+#include "common.h"
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int init_uring(struct __uring *ring, const unsigned entries)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    ring->fd = io_uring_setup(entries, &p);
+    if (ring->fd < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    ring->entries = p.sq_entries;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        perror("mmap");
+        goto err_close;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            perror("mmap");
+            goto err_unmap_sq;
+        }
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        perror("mmap");
+        goto err_unmap_cq;
+    }
+
+    sq = (char *)ring->sq_ring;
+    ring->sq_head  = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    cq = (char *)ring->cq_ring;
+    ring->cq_head  = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    DEBUG_PRINT("io_uring: fd=%d entries=%u\n", ring->fd, ring->entries);
+    return 0;
+
+err_unmap_cq:
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+err_unmap_sq:
+    munmap(ring->sq_ring, ring->sq_ring_size);
+err_close:
+    close(ring->fd);
+    ring->fd = -1;
+    return -1;
+}
+
+void fini_uring(struct __uring *ring)
+{
+    if (ring->fd < 0) {
+        return;
+    }
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+/*
+ * Queue a read() of len bytes from fd. It returns -1 if the submission
+ * queue is full; call uring_wait() and retry.
+ */
+int uring_read(struct __uring *ring, const int fd, void *buf, const unsigned len, const uint64_t user_data)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned idx;
+    struct io_uring_sqe *sqe;
+
+    if (tail - head >= ring->entries || ring->pending >= ring->entries) {
+        return -1;
+    }
+    idx = tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_READ;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)(uintptr_t)buf;
+    sqe->len       = len;
+    sqe->off       = 0;
+    sqe->user_data = user_data;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+    return 0;
+}
+
+/*
+ * Submit all the queued reads at once and wait for their completion.
+ * complete() is called for each of them with the user data and the result
+ * of the read(). It returns the number of the failed reads, or -1.
+ */
+int uring_wait(struct __uring *ring, void (*complete)(uint64_t, int, void *), void *arg)
+{
+    unsigned head, n = ring->pending;
+    int failed = 0;
+
+    if (n == 0) {
+        return 0;
+    }
+    ring->pending = 0;
+    if (io_uring_enter(ring->fd, n, n, IORING_ENTER_GETEVENTS) < 0) {
+        perror("io_uring_enter");
+        return -1;
+    }
+    while (n > 0) {
+        head = *ring->cq_head;
+        while (n > 0 && head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            if (cqe->res < 0) {
+                failed++;
+            }
+            complete(cqe->user_data, cqe->res, arg);
+            head++;
+            n--;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        if (n > 0 && io_uring_enter(ring->fd, 0, n, IORING_ENTER_GETEVENTS) < 0) {
+            perror("io_uring_enter");
+            return -1;
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#ifndef __URING_H
+#define __URING_H
+#include <linux/io_uring.h>
+#include "types.h"
+
+/* A minimal io_uring used to read performance counters in a batch. */
+struct __uring {
+    int fd;
+    unsigned entries;
+    unsigned pending;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+int init_uring(struct __uring *, const unsigned);
+void fini_uring(struct __uring *);
+int uring_read(struct __uring *, const int, void *, const unsigned, const uint64_t);
+int uring_wait(struct __uring *, void (*)(uint64_t, int, void *), void *);
+#endif
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "workers.h"
+#include "snapshot.h"
+#include "perf.h"
+
+static void *worker_main(void *arg)
+{
+    struct __worker *w = (struct __worker *)arg;
+    struct __workers *wk = w->wk;
+    uint32_t k, n;
+
+    perf_set_pinned_cpu(w->cpu);
+    while (1) {
+        pthread_barrier_wait(&wk->start);
+        if (wk->quit) {
+            break;
+        }
+        /* the active list is not changed during the epoch */
+        n = nr_active_mons();
+        for (k = w->id; k < n; k += wk->nworkers) {
+            emul_mon_stop(wk->emul, active_mon(k));
+        }
+        pthread_barrier_wait(&wk->stopped);
+        /* read the snapshot and the PEBS buffers of the epoch, divided among the workers */
+        read_snapshot_part(wk->emul->pmu, wk->emul->snap, w->id, wk->nworkers, w->ringp);
+        pebs_drain_cpus(w->id, wk->nworkers);
+        if (pthread_barrier_wait(&wk->read) == PTHREAD_BARRIER_SERIAL_THREAD) {
+            sum_snapshot(wk->emul->snap);
+        }
+        pthread_barrier_wait(&wk->summed);
+        for (k = w->id; k < n; k += wk->nworkers) {
+            emul_mon_epoch(wk->emul, active_mon(k), &wk->epoch, &w->diff_nsec);
+        }
+        pthread_barrier_wait(&wk->done);
+    }
+
+    return NULL;
+}
+
+/*
+ * Choose the CPU of the n-th worker. CPU cores not reserved for the target
+ * application are preferred. With rdpmc, the n-th worker is pinned to the
+ * n-th reserved CPU core, whose counters it reads in the snapshot while the
+ * target threads on the core are stopped.
+ */
+static int worker_cpu(const int n, cpu_set_t *use_cpuset, const bool rdpmc)
+{
+    int cpuid, cnt = 0, nfree = 0;
+    int ncpu = num_of_cpu();
+
+    if (rdpmc) {
+        for (cpuid = 0; cpuid < ncpu; cpuid++) {
+            if (CPU_ISSET(cpuid, use_cpuset) && cnt++ == n % CPU_COUNT(use_cpuset)) {
+                return cpuid;
+            }
+        }
+        return n % ncpu;
+    }
+    for (cpuid = 0; cpuid < ncpu; cpuid++) {
+        if (!CPU_ISSET(cpuid, use_cpuset)) {
+            nfree++;
+        }
+    }
+    if (nfree == 0) {
+        return n % ncpu;
+    }
+    for (cpuid = 0; cpuid < ncpu; cpuid++) {
+        if (CPU_ISSET(cpuid, use_cpuset)) {
+            continue;
+        }
+        if (cnt == n % nfree) {
+            break;
+        }
+        cnt++;
+    }
+    return cpuid;
+}
+
+/*
+ * With rdpmc, the r-th reserved CPU core is read by the (r % nworkers)-th
+ * worker, which is pinned to the core if r < nworkers. The other cores
+ * follow, and are read with read().
+ */
+static void set_cpu_parts(struct __pmu_info *pmu, const int nworkers, cpu_set_t *use_cpuset)
+{
+    int cpuid, r = 0;
+    int ncpu = num_of_cpu();
+
+    pmu->cpu_part = (int *)calloc(sizeof(int), ncpu);
+    if (pmu->cpu_part == NULL) {
+        handle_error("calloc");
+    }
+    for (cpuid = 0; cpuid < ncpu; cpuid++) {
+        if (CPU_ISSET(cpuid, use_cpuset)) {
+            pmu->cpu_part[cpuid] = r++ % nworkers;
+        }
+    }
+    for (cpuid = 0; cpuid < ncpu; cpuid++) {
+        if (!CPU_ISSET(cpuid, use_cpuset)) {
+            pmu->cpu_part[cpuid] = r++ % nworkers;
+        }
+    }
+    if (CPU_COUNT(use_cpuset) > nworkers) {
+        fprintf(stderr, "Warning: %d of the %d reserved CPU cores are read with rdpmc. Give -j %d to read all of them.\n",
+                nworkers, CPU_COUNT(use_cpuset), CPU_COUNT(use_cpuset));
+    }
+}
+
+int init_workers(struct __workers *wk, const int nworkers, const struct __emul *emul, cpu_set_t *use_cpuset)
+{
+    int i, r;
+    cpu_set_t cpuset;
+    pthread_attr_t attr;
+
+    memset(wk, 0, sizeof(*wk));
+    wk->nworkers = nworkers;
+    wk->emul = emul;
+    wk->workers = (struct __worker *)calloc(sizeof(struct __worker), nworkers);
+    if (wk->workers == NULL) {
+        handle_error("calloc");
+    }
+    if (emul->pmu->rdpmc) {
+        set_cpu_parts(emul->pmu, nworkers, use_cpuset);
+    }
+    if (pthread_barrier_init(&wk->start, NULL, nworkers + 1) != 0 ||
+        pthread_barrier_init(&wk->stopped, NULL, nworkers) != 0 ||
+        pthread_barrier_init(&wk->read, NULL, nworkers) != 0 ||
+        pthread_barrier_init(&wk->summed, NULL, nworkers) != 0 ||
+        pthread_barrier_init(&wk->done, NULL, nworkers + 1) != 0) {
+        fprintf(stderr, "%s pthread_barrier_init failed.\n", __func__);
+        return -1;
+    }
+
+    for (i = 0; i < nworkers; i++) {
+        struct __worker *w = &wk->workers[i];
+        w->id = i;
+        w->wk = wk;
+        w->cpu = worker_cpu(i, use_cpuset, emul->pmu->rdpmc);
+        w->ringp = NULL;
+        if (emul->pmu->uring) {
+            if (init_snapshot_uring(&w->ring, nworkers) < 0) {
+                fprintf(stderr, "%s io_uring is not available, fall back to read(). worker:%d\n", __func__, i);
+            } else {
+                w->ringp = &w->ring;
+            }
+        }
+        CPU_ZERO(&cpuset);
+        CPU_SET(w->cpu, &cpuset);
+        pthread_attr_init(&attr);
+        r = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
+        if (r != 0) {
+            fprintf(stderr, "%s pthread_attr_setaffinity_np failed. worker:%d cpu:%d\n", __func__, i, w->cpu);
+            return -1;
+        }
+        r = pthread_create(&w->thread, &attr, worker_main, w);
+        pthread_attr_destroy(&attr);
+        if (r != 0) {
+            fprintf(stderr, "%s pthread_create failed. worker:%d\n", __func__, i);
+            return -1;
+        }
+        DEBUG_PRINT("worker %d: cpu %d\n", i, w->cpu);
+    }
+
+    return 0;
+}
+
+/* Process one epoch of all the monitors, and wait for all the workers. */
+void run_workers(struct __workers *wk, const struct __epoch *ep)
+{
+    wk->epoch = *ep;
+    pthread_barrier_wait(&wk->start);
+    pthread_barrier_wait(&wk->done);
+}
+
+void fini_workers(struct __workers *wk)
+{
+    int i;
+
+    wk->quit = true;
+    pthread_barrier_wait(&wk->start);
+    for (i = 0; i < wk->nworkers; i++) {
+        pthread_join(wk->workers[i].thread, NULL);
+        if (wk->workers[i].ringp != NULL) {
+            fini_uring(wk->workers[i].ringp);
+        }
+    }
+    pthread_barrier_destroy(&wk->start);
+    pthread_barrier_destroy(&wk->stopped);
+    pthread_barrier_destroy(&wk->read);
+    pthread_barrier_destroy(&wk->summed);
+    pthread_barrier_destroy(&wk->done);
+    free(wk->workers);
+    wk->workers = NULL;
+    free(wk->emul->pmu->cpu_part);
+    wk->emul->pmu->cpu_part = NULL;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2016-2020: National Institute of Advanced Industrial Science
+ * and Technology (AIST). All right reserved.
+ */
+/*  vim: set expandtab ts=4 sw=4 ai: */
+
+#ifndef __WORKERS_H
+#define __WORKERS_H
+#include <pthread.h>
+#include <sched.h>
+#include "emul.h"
+#include "uring.h"
+
+struct __worker {
+    pthread_t thread;
+    int id;
+    int cpu;
+    uint64_t diff_nsec;
+    struct __uring ring;
+    struct __uring *ringp;  /* NULL if io_uring is not used */
+    struct __workers *wk;
+};
+
+/*
+ * Emulator worker threads. The k-th monitor of the active list is processed
+ * by the (k % nworkers)-th worker in every epoch. An epoch has three phases
+ * separated by barriers: stopping the monitors, reading the snapshot of the
+ * counters and calculating the delays.
+ */
+struct __workers {
+    int nworkers;
+    bool quit;
+    const struct __emul *emul;
+    struct __epoch epoch;
+    pthread_barrier_t start;
+    pthread_barrier_t stopped;
+    pthread_barrier_t read;
+    pthread_barrier_t summed;
+    pthread_barrier_t done;
+    struct __worker *workers;
+};
+
+int init_workers(struct __workers *, const int, const struct __emul *, cpu_set_t *);
+void run_workers(struct __workers *, const struct __epoch *);
+void fini_workers(struct __workers *);
+#endif